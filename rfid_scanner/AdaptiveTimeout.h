@@ -0,0 +1,129 @@
+#ifndef ADAPTIVE_TIMEOUT_H
+#define ADAPTIVE_TIMEOUT_H
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+/* =====================================================================
+ *  AdaptiveTimeout.h — automation timeout learned from real run times
+ *
+ *  Tracks how long an automation takes from run() to its done callback
+ *  with an exponentially weighted mean and variance, and places the
+ *  timeout at roughly p99 + margin, clamped to [minMs, maxMs].
+ *
+ *    • until enough samples are seen the timeout is maxMs
+ *    • each consecutive timeout doubles the limit (up to maxMs), so a
+ *      show that genuinely got longer is still caught and re-learned
+ *    • estimates are saved to EEPROM, keyed by the automation's name,
+ *      so a reboot or a swapped automation starts from the right data
+ * ===================================================================== */
+
+class AdaptiveTimeout {
+public:
+  AdaptiveTimeout(unsigned long minMs, unsigned long maxMs, unsigned long marginMs, int eepromAddr)
+    : minMs_(minMs), maxMs_(maxMs), marginMs_(marginMs), eepromAddr_(eepromAddr) {}
+
+  /* Load a saved estimate if it was recorded for the same automation. */
+  void begin(const char* name) {
+    key_ = hash(name);
+
+    Record r;
+    EEPROM.get(eepromAddr_, r);
+    if (r.magic == MAGIC && r.key == key_ && r.samples > 0) {
+      mean_ = r.mean;
+      var_ = r.var;
+      samples_ = r.samples;
+    }
+
+    Serial.print("Automation timeout ");
+    Serial.print(timeoutMs());
+    Serial.print("ms (samples=");
+    Serial.print(samples_);
+    Serial.println(")");
+  }
+
+  /* Record a completed run, in ms from run() to the done callback. */
+  void addSample(unsigned long ms) {
+    float x = (float)ms;
+    if (samples_ == 0) {
+      mean_ = x;
+      var_ = 0;
+    } else {
+      float diff = x - mean_;
+      float incr = ALPHA * diff;
+      mean_ += incr;
+      var_ = (1 - ALPHA) * (var_ + diff * incr);
+    }
+    if (samples_ < 0xFFFF) samples_++;
+    consecutiveTimeouts_ = 0;
+
+    if (++unsaved_ >= SAVE_EVERY) {
+      save();
+    }
+  }
+
+  /* Record a run that hit the timeout.  Not used as a sample (it's censored),
+     but widens the next limit. */
+  void addTimeout() {
+    if (consecutiveTimeouts_ < 8) consecutiveTimeouts_++;
+  }
+
+  unsigned long timeoutMs() const {
+    if (samples_ < MIN_SAMPLES) {
+      return maxMs_;
+    }
+
+    unsigned long t = (unsigned long)(mean_ + Z_P99 * sqrtf(var_)) + marginMs_;
+    t <<= consecutiveTimeouts_;
+    return constrain(t, minMs_, maxMs_);
+  }
+
+  float mean() const { return mean_; }
+  float stddev() const { return sqrtf(var_); }
+  uint16_t samples() const { return samples_; }
+
+  void save() {
+    Record r = { MAGIC, key_, mean_, var_, samples_ };
+    EEPROM.put(eepromAddr_, r);
+    unsaved_ = 0;
+  }
+
+private:
+  struct Record {
+    uint32_t magic;
+    uint32_t key;
+    float mean;
+    float var;
+    uint16_t samples;
+  };
+
+  static constexpr uint32_t MAGIC = 0xA7070001;
+  static constexpr float ALPHA = 0.2f;     // weight of the newest sample
+  static constexpr float Z_P99 = 2.326f;   // one-sided 99th percentile of a normal
+  static constexpr uint16_t MIN_SAMPLES = 5;
+  static constexpr uint8_t SAVE_EVERY = 8; // limit flash wear
+
+  unsigned long minMs_;
+  unsigned long maxMs_;
+  unsigned long marginMs_;
+  int eepromAddr_;
+
+  uint32_t key_ = 0;
+  float mean_ = 0;
+  float var_ = 0;
+  uint16_t samples_ = 0;
+  uint8_t unsaved_ = 0;
+  uint8_t consecutiveTimeouts_ = 0;
+
+  // FNV-1a
+  static uint32_t hash(const char* s) {
+    uint32_t h = 2166136261UL;
+    while (*s) {
+      h ^= (uint8_t)*s++;
+      h *= 16777619UL;
+    }
+    return h;
+  }
+};
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef AUTOMATION_H
 #define AUTOMATION_H
 #include <Arduino.h>
+#include "Log.h"
+#include "Trace.h"
 
 /* =====================================================================
  *  Automation.h — minimal non‑blocking automation interface
@@ -10,7 +12,8 @@
  *    • starts on demand (run())
  *    • progresses without blocking (update())
  *    • calls a user‑supplied DoneCb exactly once when finished
- *    • can be cancelled by calling cancel() at any time
+ *    • can be cancelled by calling cancel() at any time, and reports
+ *      through idle() once the hardware has actually stopped
  *
  *  No dynamic allocation, no <functional>; the callback is a plain
  *  C‑style pointer so it works on every Arduino target.
@@ -21,9 +24,14 @@ public:
   using DoneCb = void (*)();        // callback type: void fn()
 
   /* One‑time initialization — called from the sketch’s setup().
-     Override if your automation needs pinMode(), etc.        */
+     Override if your automation needs pinMode(), etc.  Must not
+     block: longer self‑tests are started here and advanced by
+     update(), which is also called while the scanner is idle. */
   virtual void setup() {}
 
+  /* False while a self‑test started by setup() is still running. */
+  virtual bool ready() const { return true; }
+
   /* Kick off the automation.  Implementation saves cb and returns
      immediately so loop() can keep running.                  */
   virtual void run(DoneCb cb) = 0;
@@ -32,9 +40,22 @@ public:
      Call the saved cb once the work is complete.             */
   virtual void update() = 0;
 
-   /* Cancel the automation at any time. */
+  /* Cancel the automation at any time.  Must not block: send the stop
+     commands and return.  The saved cb is never called after this.
+     If the hardware takes time to confirm it has stopped, return
+     false from idle() until update() sees it has.             */
   virtual void cancel() = 0;
 
+  /* False while stopping after cancel(); the scanner won't run() again
+     until this is true, so a new show never starts over the old one. */
+  virtual bool idle() const { return true; }
+
+  /* Short, stable name; keys data persisted per automation type. */
+  virtual const char* name() const { return "Automation"; }
+
+  /* Print automation-specific timing stats with the health check. */
+  virtual void printStats(Stream& out) {}
+
   virtual ~Automation() = default;
 };
 #endif
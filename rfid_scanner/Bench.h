@@ -0,0 +1,59 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <Arduino.h>
+#include <malloc.h>
+
+/* =====================================================================
+ *  Bench.h — on-device microbenchmarks
+ *
+ *    bench(Serial, "uid_string", 1000, [] { uid_string(uid, 7); });
+ *
+ *  Times fn() with the Cortex-M4 DWT cycle counter and prints one JSON
+ *  line per benchmark, so output can be collected and diffed per change:
+ *
+ *    {"bench":"uid_string","iters":1000,"cycles_per_op":812,
+ *     "ns_per_op":16916,"heap_bytes_per_op":0,"arena_growth_bytes":0}
+ *
+ *  heap_bytes_per_op is heap still held after the run (leaks);
+ *  arena_growth_bytes is how far the heap had to grow to serve the run.
+ *  newlib doesn't count allocations, so these stand in for allocations/op.
+ * ===================================================================== */
+
+inline void benchBegin() {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+template <typename Fn>
+void bench(Print& out, const char* name, uint32_t iters, Fn fn) {
+  fn();  // warm up, and let lazily allocated buffers settle
+
+  struct mallinfo before = mallinfo();
+
+  uint32_t start = DWT->CYCCNT;
+  for (uint32_t i = 0; i < iters; i++) {
+    fn();
+  }
+  uint32_t cycles = DWT->CYCCNT - start;
+
+  struct mallinfo after = mallinfo();
+
+  uint32_t perOp = cycles / iters;
+  out.print("{\"bench\":\"");
+  out.print(name);
+  out.print("\",\"iters\":");
+  out.print(iters);
+  out.print(",\"cycles_per_op\":");
+  out.print(perOp);
+  out.print(",\"ns_per_op\":");
+  out.print((uint32_t)((uint64_t)cycles * 1000000000ULL / SystemCoreClock / iters));
+  out.print(",\"heap_bytes_per_op\":");
+  out.print(((long)after.uordblks - (long)before.uordblks) / (long)iters);
+  out.print(",\"arena_growth_bytes\":");
+  out.print((long)after.arena - (long)before.arena);
+  out.println("}");
+}
+
+#endif
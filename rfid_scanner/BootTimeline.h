@@ -0,0 +1,40 @@
+#ifndef BOOT_TIMELINE_H
+#define BOOT_TIMELINE_H
+
+#include <Arduino.h>
+
+// Records when each boot milestone was reached, for the boot report.
+template <size_t CAPACITY>
+class BootTimeline {
+public:
+  void mark(const char* name) {
+    if (_count >= CAPACITY) return;
+    _names[_count] = name;
+    _at[_count] = millis();
+    ++_count;
+  }
+
+  bool has(const char* name) const {
+    for (size_t i = 0; i < _count; ++i) {
+      if (strcmp(_names[i], name) == 0) return true;
+    }
+    return false;
+  }
+
+  void print(Stream& out) const {
+    out.println("Boot timeline:");
+    for (size_t i = 0; i < _count; ++i) {
+      out.print("  +");
+      out.print(_at[i]);
+      out.print("ms ");
+      out.println(_names[i]);
+    }
+  }
+
+private:
+  const char* _names[CAPACITY];
+  unsigned long _at[CAPACITY];
+  size_t _count = 0;
+};
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef CBOR_WRITER_H
+#define CBOR_WRITER_H
+
+#include <Arduino.h>
+
+/* =====================================================================
+ *  CborWriter.h — minimal CBOR (RFC 8949) encoder into a fixed buffer
+ *
+ *    CborWriter w(buf, sizeof(buf));
+ *    w.map(2);
+ *    w.key("id");  w.text(uid);
+ *    w.key("loc"); w.integer(LOCATION);
+ *    if (w.ok()) send(buf, w.length());
+ *
+ *  Maps and arrays are definite-length, so the caller gives the item
+ *  count up front.  Writes past the end of the buffer are dropped and
+ *  make ok() false; nothing is allocated.
+ * ===================================================================== */
+
+class CborWriter {
+public:
+  CborWriter(uint8_t* buf, size_t size) : buf_(buf), size_(size) {}
+
+  void map(size_t pairs) { head(5, pairs); }
+  void array(size_t items) { head(4, items); }
+  void key(const char* k) { text(k); }
+
+  void text(const char* s) {
+    size_t n = strlen(s);
+    head(3, n);
+    raw((const uint8_t*)s, n);
+  }
+
+  void bytes(const uint8_t* p, size_t n) {
+    head(2, n);
+    raw(p, n);
+  }
+
+  void integer(long v) {
+    if (v < 0) {
+      head(1, (uint32_t)(-1 - v));
+    } else {
+      head(0, (uint32_t)v);
+    }
+  }
+
+  void boolean(bool b) { put(b ? 0xF5 : 0xF4); }
+
+  size_t length() const { return len_; }
+  bool ok() const { return !overflow_; }
+
+private:
+  uint8_t* buf_;
+  size_t size_;
+  size_t len_ = 0;
+  bool overflow_ = false;
+
+  // Major type and argument, in the shortest form
+  void head(uint8_t major, uint32_t v) {
+    uint8_t m = major << 5;
+    if (v < 24) {
+      put(m | v);
+    } else if (v <= 0xFF) {
+      put(m | 24);
+      put(v);
+    } else if (v <= 0xFFFF) {
+      put(m | 25);
+      put(v >> 8);
+      put(v);
+    } else {
+      put(m | 26);
+      put(v >> 24);
+      put(v >> 16);
+      put(v >> 8);
+      put(v);
+    }
+  }
+
+  void raw(const uint8_t* p, size_t n) {
+    if (len_ + n > size_) {
+      overflow_ = true;
+      return;
+    }
+    memcpy(buf_ + len_, p, n);
+    len_ += n;
+  }
+
+  void put(uint8_t b) {
+    if (len_ >= size_) {
+      overflow_ = true;
+      return;
+    }
+    buf_[len_++] = b;
+  }
+};
+
+#endif
@@ -0,0 +1,299 @@
+#ifndef CUE_AUTOMATION_H
+#define CUE_AUTOMATION_H
+
+#include "Automation.h"
+#include "WledLink.h"
+#include <SoftwareSerial.h>
+#include <DYPlayerArduino.h>  // External: https://github.com/SnijderC/dyplayer (download zip and add manually)
+
+/* =====================================================================
+ *  CueAutomation.h — light, sound and signal cues on one timeline
+ *
+ *  A show is a const table of cues (kept in flash), each at an offset
+ *  from the scan:
+ *
+ *    const Cue show[] = {
+ *      CUE_PRESET(0, 3),             // WLED preset 3 at t=0
+ *      CUE_TRACK(150, 2),            // DY track 2 at t=150ms
+ *      CUE_COLOR(2400, 255, 0, 0),   // WLED solid red at t=2.4s
+ *      CUE_SIGNAL(2400, HIGH),       // signal pin HIGH at t=2.4s
+ *      CUE_END(10000),               // lights off, show done at t=10s
+ *    };
+ *    CueAutomation automation(show, CUE_COUNT(show));
+ *
+ *  WLED cues go through a WledLink, so they share its state shadow and
+ *  confirmations with WledAutomation: a cue only sends what changes,
+ *  and idle() waits for WLED to confirm the lights went off.
+ *
+ *  Each device takes time between the command and the visible/audible
+ *  effect, so cues are fired early by that device's latency:
+ *    • DY player: measured from the command to the BUSY pin falling
+ *    • WLED: measured UART send time + CUE_WLED_PROCESS_US
+ *    • signal pin: none
+ *  printStats() reports, per cue, how far the achieved time landed from
+ *  the scheduled one.
+ * ===================================================================== */
+
+#define CUE_WLED_TX_PIN 5    // ➜ WLED RX
+#define CUE_WLED_RX_PIN 4    // ⇐ WLED TX
+#define CUE_WLED_BAUD 115200
+#define CUE_DY_TX_PIN 7      // ➜ DY RX
+#define CUE_DY_RX_PIN 6      // ⇐ DY TX
+#define CUE_DY_BUSY_PIN 3    // LOW while playing
+#define CUE_DY_BAUD 9600
+#define CUE_SIGNAL_PIN 2
+
+#define CUE_MAX 32                     // cues per show
+#define CUE_WLED_PROCESS_US 5000       // WLED parse + first frame, after the last byte
+#define CUE_DY_LATENCY_US 80000        // starting guess, until BUSY is measured
+#define CUE_VOLUME 25                  // 0...30
+#define CUE_STOP_RETRY_MS 250          // resend stop if BUSY is still LOW after this
+
+enum CueAction : uint8_t {
+  CUE_ACTION_PRESET,
+  CUE_ACTION_COLOR,
+  CUE_ACTION_TRACK,
+  CUE_ACTION_STOP_SOUND,
+  CUE_ACTION_SIGNAL,
+  CUE_ACTION_END,
+};
+
+struct Cue {
+  uint16_t atMs;
+  uint8_t action;
+  uint8_t a, b, c;
+};
+
+#define CUE_PRESET(t, ps) { (t), CUE_ACTION_PRESET, (ps), 0, 0 }
+#define CUE_COLOR(t, r, g, b) { (t), CUE_ACTION_COLOR, (r), (g), (b) }
+#define CUE_TRACK(t, n) { (t), CUE_ACTION_TRACK, (n), 0, 0 }
+#define CUE_STOP_SOUND(t) { (t), CUE_ACTION_STOP_SOUND, 0, 0, 0 }
+#define CUE_SIGNAL(t, level) { (t), CUE_ACTION_SIGNAL, (level), 0, 0 }
+#define CUE_END(t) { (t), CUE_ACTION_END, 0, 0, 0 }
+#define CUE_COUNT(cues) (sizeof(cues) / sizeof((cues)[0]))
+
+class CueAutomation : public Automation {
+public:
+  CueAutomation(const Cue* cues, uint8_t count)
+    : cues_(cues), count_(min(count, (uint8_t)CUE_MAX)),
+      wledSerial(CUE_WLED_RX_PIN, CUE_WLED_TX_PIN), wled(wledSerial), dySerial(CUE_DY_RX_PIN, CUE_DY_TX_PIN), player(&dySerial) {}
+
+  void setup() override {
+    Serial.println("Setting up cue automation");
+
+    pinMode(CUE_SIGNAL_PIN, OUTPUT);
+    digitalWrite(CUE_SIGNAL_PIN, LOW);
+    pinMode(CUE_DY_BUSY_PIN, INPUT_PULLUP);
+
+    wledSerial.begin(CUE_WLED_BAUD);
+    dySerial.begin(CUE_DY_BAUD);
+    player.begin();
+    player.setVolume(CUE_VOLUME);
+  }
+
+  void run(DoneCb cb) override {
+    LOG_INFO("[Action] starting show of %u cues", count_);
+    fired_ = 0;
+    pendingTrack_ = -1;
+    startUs_ = micros();
+    doneCb_ = cb;
+    active_ = true;
+    update();  // t=0 cues go out now
+  }
+
+  void update() override {
+    wled.poll();
+
+    if (stopping_) {
+      if (digitalRead(CUE_DY_BUSY_PIN) == HIGH) {
+        stopping_ = false;
+      } else if (millis() - stopAt_ >= CUE_STOP_RETRY_MS) {
+        player.stop();  // the module missed it; ask again
+        stopAt_ = millis();
+      }
+      return;
+    }
+
+    if (!active_) return;
+
+    unsigned long now = micros();
+    unsigned long elapsed = now - startUs_;
+
+    // Sound latency: command to BUSY falling
+    if (pendingTrack_ >= 0 && digitalRead(CUE_DY_BUSY_PIN) == LOW) {
+      unsigned long latency = now - trackSentUs_;
+      dyLatencyUs_ = dyLatencyUs_ ? (dyLatencyUs_ * 3 + latency) / 4 : latency;
+      recordError(pendingTrack_, (long)(now - startUs_) - (long)cues_[pendingTrack_].atMs * 1000L);
+      pendingTrack_ = -1;
+    }
+
+    for (uint8_t i = 0; i < count_; i++) {
+      if (fired_ & (1UL << i)) continue;
+
+      const Cue& cue = cues_[i];
+      unsigned long due = (unsigned long)cue.atMs * 1000UL;
+      unsigned long lead = leadUs(cue.action);
+      due = due > lead ? due - lead : 0;
+      if (elapsed < due) continue;
+
+      fired_ |= 1UL << i;
+      if (fire(i)) {
+        return;  // show ended
+      }
+    }
+  }
+
+  void cancel() override {
+    if (!active_) return;
+
+    LOG_INFO("[Cancel] show was cancelled");
+    stopAll();
+    active_ = false;
+    doneCb_ = nullptr;
+    stopping_ = true;
+    stopAt_ = millis();
+  }
+
+  /* Idle once BUSY shows the sound has stopped and WLED has confirmed
+     the lights are off (or given up on it) */
+  bool idle() const override { return !stopping_ && wled.idle(); }
+
+  const char* name() const override { return "CueAutomation"; }
+
+  void printStats(Stream& out) override {
+    wled.printStats(out);
+    out.print("[Cues] wled_send_us=");
+    out.print(wledSendUs_);
+    out.print(" dy_latency_us=");
+    out.println(dyLatencyUs_);
+    for (uint8_t i = 0; i < count_; i++) {
+      out.print("  cue ");
+      out.print(i);
+      out.print(" at=");
+      out.print(cues_[i].atMs);
+      out.print("ms action=");
+      out.print(cues_[i].action);
+      out.print(" error_us(last/max)=");
+      out.print(lastErrorUs_[i]);
+      out.print("/");
+      out.println(maxErrorUs_[i]);
+    }
+  }
+
+private:
+  const Cue* cues_;
+  uint8_t count_;
+
+  DoneCb doneCb_ = nullptr;
+  bool active_ = false;
+  bool stopping_ = false;
+  unsigned long stopAt_ = 0;
+  SoftwareSerial wledSerial;
+  WledLink wled;
+  SoftwareSerial dySerial;
+  DY::Player player;
+
+  unsigned long startUs_ = 0;
+  uint32_t fired_ = 0;           // bit per cue
+  int8_t pendingTrack_ = -1;     // track cue waiting for BUSY to fall
+  unsigned long trackSentUs_ = 0;
+
+  unsigned long wledSendUs_ = 0;  // EWMA of the UART send time
+  unsigned long dyLatencyUs_ = 0; // EWMA of command to BUSY falling
+  long lastErrorUs_[CUE_MAX] = {};
+  long maxErrorUs_[CUE_MAX] = {};
+
+  unsigned long leadUs(uint8_t action) const {
+    switch (action) {
+      case CUE_ACTION_PRESET:
+      case CUE_ACTION_COLOR:
+        return wledSendUs_ + CUE_WLED_PROCESS_US;
+      case CUE_ACTION_TRACK:
+        return dyLatencyUs_ ? dyLatencyUs_ : CUE_DY_LATENCY_US;
+      default:
+        return 0;
+    }
+  }
+
+  /* Fire cue i.  Returns true if it ended the show. */
+  bool fire(uint8_t i) {
+    const Cue& cue = cues_[i];
+    unsigned long firedAt = micros();
+
+    switch (cue.action) {
+      case CUE_ACTION_PRESET: {
+        WledState want;
+        want.on = true;
+        want.ps = cue.a;
+        sendWled(want, WledState::ON | WledState::PS, i, firedAt);
+        break;
+      }
+      case CUE_ACTION_COLOR: {
+        WledState want;
+        want.on = true;
+        want.fx = 0;  // solid
+        want.col[0] = cue.a;
+        want.col[1] = cue.b;
+        want.col[2] = cue.c;
+        sendWled(want, WledState::ON | WledState::FX | WledState::COL, i, firedAt);
+        break;
+      }
+      case CUE_ACTION_TRACK:
+        player.playSpecified(cue.a);
+        trackSentUs_ = firedAt;
+        pendingTrack_ = i;  // error is recorded when BUSY falls
+        break;
+      case CUE_ACTION_STOP_SOUND:
+        player.stop();
+        recordError(i, (long)(firedAt - startUs_) - (long)cue.atMs * 1000L);
+        break;
+      case CUE_ACTION_SIGNAL:
+        digitalWrite(CUE_SIGNAL_PIN, cue.a ? HIGH : LOW);
+        recordError(i, (long)(firedAt - startUs_) - (long)cue.atMs * 1000L);
+        break;
+      case CUE_ACTION_END:
+        recordError(i, (long)(firedAt - startUs_) - (long)cue.atMs * 1000L);
+        stopAll();
+        LOG_INFO("[Action] show done");
+        active_ = false;
+        if (doneCb_) {
+          DoneCb cb = doneCb_;  // copy in case cb restarts us
+          doneCb_ = nullptr;
+          cb();  // notify caller exactly once
+        }
+        return true;
+    }
+    return false;
+  }
+
+  // SoftwareSerial writes block until the last bit is out, so the time
+  // spent here is the on-wire time.  A cue WLED already shows sends
+  // nothing, and isn't counted in the send time.
+  void sendWled(const WledState& want, uint8_t fields, uint8_t i, unsigned long firedAt) {
+    uint32_t before = wled.transitions();
+    wled.set(want, fields);
+    if (wled.transitions() != before) {
+      unsigned long sent = micros() - firedAt;
+      wledSendUs_ = wledSendUs_ ? (wledSendUs_ * 3 + sent) / 4 : sent;
+    }
+
+    unsigned long effectAt = micros() + CUE_WLED_PROCESS_US;
+    recordError(i, (long)(effectAt - startUs_) - (long)cues_[i].atMs * 1000L);
+  }
+
+  void stopAll() {
+    WledState off;
+    off.on = false;
+    wled.set(off, WledState::ON);
+    player.stop();
+    digitalWrite(CUE_SIGNAL_PIN, LOW);
+    pendingTrack_ = -1;
+  }
+
+  void recordError(uint8_t i, long errorUs) {
+    lastErrorUs_[i] = errorUs;
+    if (abs(errorUs) > abs(maxErrorUs_[i])) maxErrorUs_[i] = errorUs;
+  }
+};
+
+#endif
@@ -24,7 +24,7 @@ public:
   }
 
   void run(DoneCb cb) override {
-    Serial.println("[Action] reset TX to LOW before HIGH to create rising edge");
+    LOG_DEBUG("[Action] reset TX to LOW before HIGH to create rising edge");
 
     // Generate a clean LOW-to-HIGH edge
     digitalWrite(TX_PIN, LOW);   // force LOW
@@ -40,8 +40,9 @@ public:
     if (!active_) return;
 
     bool now = digitalRead(RX_PIN);
+    if (now != last) TRACE(TRACE_PIN, RX_PIN, now, 0);
     if (last == LOW && now == HIGH) {
-      Serial.println("[Action] automation done - rising edge detected");
+      LOG_INFO("[Action] automation done - rising edge detected");
       active_ = false;
       digitalWrite(TX_PIN, LOW);  // reset signal so it’s ready for next run
       if (doneCb_) {
@@ -56,12 +57,14 @@ public:
   void cancel() override {
     if (!active_) return;
 
-    Serial.println("[Cancel] automation was cancelled");
+    LOG_INFO("[Cancel] automation was cancelled");
     active_ = false;
     doneCb_ = nullptr;
     digitalWrite(TX_PIN, LOW);  // reset signal so it’s ready for next run
   }
 
+  const char* name() const override { return "DigitalSignalAutomation"; }
+
 private:
   DoneCb doneCb_ = nullptr;
   bool active_ = false;
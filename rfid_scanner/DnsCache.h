@@ -0,0 +1,134 @@
+#ifndef DNS_CACHE_H
+#define DNS_CACHE_H
+
+#include <Arduino.h>
+#include <WiFiS3.h>
+#include "Log.h"
+#include "Trace.h"
+#include "StallWatch.h"
+
+/* =====================================================================
+ *  DnsCache.h — single-host resolver cache
+ *
+ *  Keeps the last resolved address of one hostname so uploads can
+ *  connect straight to an IP:
+ *    • entries are fresh for ttlMs (the modem doesn't expose record TTLs)
+ *    • poll() refreshes the entry ahead of expiry while the scanner is idle
+ *    • if a lookup fails, the last known address is served stale
+ *    • invalidate() forces a fresh lookup, e.g. after connects fail
+ * ===================================================================== */
+
+class DnsCache {
+public:
+  DnsCache(const char* host, unsigned long ttlMs, unsigned long refreshAheadMs)
+    : host_(host), ttlMs_(ttlMs), refreshAheadMs_(refreshAheadMs) {}
+
+  /* Address to connect to.  Returns false only when the host has never
+     resolved and a lookup fails now. */
+  bool resolve(IPAddress& ip) {
+    if (valid_ && millis() - resolvedAt_ < ttlMs_) {
+      hits_++;
+      ip = ip_;
+      return true;
+    }
+
+    misses_++;
+    if (lookup()) {
+      ip = ip_;
+      return true;
+    }
+
+    if (valid_) {
+      LOG_WARN("[DNS] lookup failed, serving stale address");
+      staleServes_++;
+      ip = ip_;
+      return true;
+    }
+    return false;
+  }
+
+  /* Call from an idle state.  Refreshes the entry shortly before it expires,
+     retrying failed refreshes no more than once per RETRY_MS. */
+  void poll() {
+    if (valid_ && millis() - resolvedAt_ < ttlMs_ - refreshAheadMs_) return;
+    if (attempted_ && millis() - lastAttemptAt_ < RETRY_MS) return;
+    // Asking the WiFi module is a round trip, so only once a lookup is due
+    if (WiFi.status() != WL_CONNECTED) return;
+
+    lookup();
+  }
+
+  void invalidate() {
+    resolvedAt_ = millis() - ttlMs_;
+  }
+
+  void printStats(Stream& out) const {
+    out.print("[DNS] ");
+    out.print(host_);
+    out.print(" ip=");
+    out.print(ip_);
+    out.print(" hits=");
+    out.print(hits_);
+    out.print(" misses=");
+    out.print(misses_);
+    out.print(" stale=");
+    out.print(staleServes_);
+    out.print(" failures=");
+    out.print(failures_);
+    out.print(" resolve_ms(last/avg/max)=");
+    out.print(lastResolveMs_);
+    out.print("/");
+    out.print(lookups_ ? totalResolveMs_ / lookups_ : 0);
+    out.print("/");
+    out.println(maxResolveMs_);
+  }
+
+private:
+  static constexpr unsigned long RETRY_MS = 10000;
+
+  const char* host_;
+  unsigned long ttlMs_;
+  unsigned long refreshAheadMs_;
+
+  IPAddress ip_;
+  bool valid_ = false;
+  unsigned long resolvedAt_ = 0;
+  unsigned long lastAttemptAt_ = 0;
+  bool attempted_ = false;
+
+  uint32_t hits_ = 0;
+  uint32_t misses_ = 0;
+  uint32_t staleServes_ = 0;
+  uint32_t failures_ = 0;
+  uint32_t lookups_ = 0;
+  unsigned long lastResolveMs_ = 0;
+  unsigned long maxResolveMs_ = 0;
+  unsigned long totalResolveMs_ = 0;
+
+  bool lookup() {
+    STALL_REGION(STALL_SITE_DNS);
+    IPAddress ip;
+    unsigned long start = millis();
+    lastAttemptAt_ = start;
+    attempted_ = true;
+    bool ok = WiFi.hostByName(host_, ip) == 1 && ip != IPAddress(0, 0, 0, 0);
+
+    lastResolveMs_ = millis() - start;
+    totalResolveMs_ += lastResolveMs_;
+    lookups_++;
+    if (lastResolveMs_ > maxResolveMs_) maxResolveMs_ = lastResolveMs_;
+    TRACE(TRACE_NET, TRACE_NET_DNS, ok, lastResolveMs_);
+
+    if (!ok) {
+      failures_++;
+      return false;
+    }
+
+    ip_ = ip;
+    valid_ = true;
+    resolvedAt_ = millis();
+    return true;
+  }
+};
+
+#endif
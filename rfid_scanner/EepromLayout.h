@@ -0,0 +1,9 @@
+#ifndef EEPROM_LAYOUT_H
+#define EEPROM_LAYOUT_H
+
+// Byte offsets of the records persisted to EEPROM (data flash on the R4).
+// Keep records from overlapping when adding new ones.
+#define EEPROM_ADDR_AUTOMATION_TIMEOUT 0  // AdaptiveTimeout::Record, 20 bytes
+#define EEPROM_ADDR_READER_TUNING 32      // ReaderTuner::Record, 8 bytes
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+#include <Arduino.h>
+
+/* =====================================================================
+ *  EventQueue.h — fixed-capacity FSM event queue
+ *
+ *  Producers (state handlers, automation callbacks, ISRs) post() events
+ *  instead of calling Fsm::trigger() directly; loop() pops them at one
+ *  well-defined point and triggers the FSM, so transitions never run
+ *  inside another state's handler.
+ *
+ *  One consumer (loop()).  post() masks interrupts for the few
+ *  instructions that claim a slot, so loop() and ISRs can both post.
+ * ===================================================================== */
+
+template <size_t CAPACITY>
+class EventQueue {
+  static_assert((CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of 2");
+
+public:
+  struct Event {
+    uint8_t id;
+    unsigned long postedAt;  // micros()
+  };
+
+  /* Returns false, and counts a drop, if the queue is full. */
+  bool post(uint8_t id) {
+    unsigned long now = micros();
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    size_t count = _head - _tail;
+    if (count >= CAPACITY) {
+      _dropped++;
+      __set_PRIMASK(primask);
+      return false;
+    }
+    Event& e = _buf[_head % CAPACITY];
+    e.id = id;
+    e.postedAt = now;
+    _head = _head + 1;
+    if (count + 1 > _highWater) _highWater = count + 1;
+    __set_PRIMASK(primask);
+    return true;
+  }
+
+  /* Returns false if empty.  Records how long the event waited. */
+  bool pop(Event& out) {
+    if (_tail == _head) return false;
+    out = _buf[_tail % CAPACITY];
+    __asm__ volatile("" ::: "memory");  // read the slot before releasing it
+    _tail = _tail + 1;
+
+    unsigned long waited = micros() - out.postedAt;
+    _delivered++;
+    _totalLatencyUs += waited;
+    if (waited > _maxLatencyUs) _maxLatencyUs = waited;
+    return true;
+  }
+
+  bool   empty() const { return _tail == _head; }
+  size_t size() const { return _head - _tail; }
+  size_t cap() const { return CAPACITY; }
+
+  size_t   highWater() const { return _highWater; }
+  uint32_t dropped() const { return _dropped; }
+  uint32_t delivered() const { return _delivered; }
+  uint32_t avgLatencyUs() const { return _delivered ? _totalLatencyUs / _delivered : 0; }
+  uint32_t maxLatencyUs() const { return _maxLatencyUs; }
+
+private:
+  Event _buf[CAPACITY];
+  volatile size_t _head = 0;  // free-running; only post() writes
+  volatile size_t _tail = 0;  // free-running; only pop() writes
+  size_t _highWater = 0;
+  uint32_t _dropped = 0;
+  uint32_t _delivered = 0;
+  uint64_t _totalLatencyUs = 0;
+  uint32_t _maxLatencyUs = 0;
+};
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef HEAP_STATS_H
+#define HEAP_STATS_H
+
+#include <Arduino.h>
+#include <malloc.h>
+
+extern "C" char* sbrk(int incr);
+extern "C" char __HeapLimit;  // end of the heap region, from the linker script
+
+/* =====================================================================
+ *  HeapStats.h — heap usage and fragmentation over a long run
+ *
+ *  sample() reads newlib's mallinfo() and the gap between the top of the
+ *  heap and the end of the heap region:
+ *    • used        bytes held by live allocations (high-water tracked)
+ *    • freeInHeap  freed chunks inside the heap, reusable but split up
+ *    • topFree     untouched space between sbrk(0) and __HeapLimit; always
+ *                  one block, so it's a lower bound on the largest free block
+ *
+ *  On the RA4M1 the stack sits below the heap, in its own fixed region,
+ *  so the heap can only grow up to __HeapLimit, not up to the stack.
+ *    • fragmentation  share of free memory stuck inside the heap
+ *
+ *  degraded() is true once free memory or the largest block falls below
+ *  the limits given to the constructor.
+ * ===================================================================== */
+
+class HeapStats {
+public:
+  HeapStats(size_t minFree, size_t minBlock)
+    : minFree_(minFree), minBlock_(minBlock) {}
+
+  void sample() {
+    struct mallinfo mi = mallinfo();
+    char* top = sbrk(0);
+    char* limit = &__HeapLimit;
+
+    used_ = mi.uordblks;
+    freeInHeap_ = mi.fordblks;
+    topFree_ = limit > top ? limit - top : 0;
+
+    if (used_ > usedHigh_) usedHigh_ = used_;
+    size_t free = totalFree();
+    if (samples_ == 0 || free < freeLow_) freeLow_ = free;
+    if (samples_ == 0 || topFree_ < blockLow_) blockLow_ = topFree_;
+    samples_++;
+  }
+
+  size_t used() const { return used_; }
+  size_t usedHigh() const { return usedHigh_; }
+  size_t totalFree() const { return freeInHeap_ + topFree_; }
+  size_t freeLow() const { return freeLow_; }
+  size_t largestBlock() const { return topFree_; }
+  size_t largestBlockLow() const { return blockLow_; }
+
+  /* Percent of free memory that's inside the heap rather than one block */
+  uint8_t fragmentation() const {
+    size_t free = totalFree();
+    return free ? (uint8_t)(100UL * freeInHeap_ / free) : 0;
+  }
+
+  bool degraded() const {
+    return samples_ > 0 && (freeLow_ < minFree_ || blockLow_ < minBlock_);
+  }
+
+  void print(Stream& out) const {
+    out.print("[Heap] used=");
+    out.print(used_);
+    out.print(" used_high=");
+    out.print(usedHigh_);
+    out.print(" free=");
+    out.print(totalFree());
+    out.print(" free_low=");
+    out.print(freeLow_);
+    out.print(" largest_block=");
+    out.print(largestBlock());
+    out.print(" largest_block_low=");
+    out.print(blockLow_);
+    out.print(" fragmentation=");
+    out.print(fragmentation());
+    out.println(degraded() ? "% DEGRADED" : "%");
+  }
+
+private:
+  size_t minFree_;
+  size_t minBlock_;
+
+  size_t used_ = 0;
+  size_t freeInHeap_ = 0;
+  size_t topFree_ = 0;
+  size_t usedHigh_ = 0;
+  size_t freeLow_ = 0;
+  size_t blockLow_ = 0;
+  uint32_t samples_ = 0;
+};
+
+#endif
@@ -0,0 +1,370 @@
+#ifndef HTTP_CONNECTION_H
+#define HTTP_CONNECTION_H
+
+#include <Arduino.h>
+#include <WiFiS3.h>
+#include <limits.h>
+#include "DnsCache.h"
+#include "LatencyStats.h"
+#include "Log.h"
+#include "StallWatch.h"
+
+/* =====================================================================
+ *  HttpConnection.h — one kept-alive HTTP(S) connection to the server
+ *
+ *    int status = http.request("POST", "/api/tracking_events", "application/json",
+ *                              json, len, reply, sizeof(reply), 3000);
+ *
+ *  Requests reuse the open connection, so a TLS handshake is paid once
+ *  per session rather than once per upload:
+ *    • the whole response is read (Content-Length or chunked), leaving
+ *      the connection clean for the next request
+ *    • a reused connection the server has quietly closed gets one retry
+ *      on a fresh connection, but only if it closed without any of a
+ *      response; a request that timed out is never sent twice
+ *    • 1xx responses are skipped, and 204/304 have no body
+ *    • poll() closes the connection after keepAliveMs without a request,
+ *      before the server's own idle timeout does
+ *  send() + responseReady() + receive() split a request so the caller
+ *  can keep looping while the server works on it.  receiveHeaders() +
+ *  readBodyLine() read a long response a few lines at a time instead,
+ *  with the framing (Content-Length, chunked) handled here.
+ *
+ *  Plain HTTP connects to the address from the DnsCache.  TLS connects
+ *  by name, since the certificate is checked against it.
+ *
+ *  The WiFi module does the TLS itself and doesn't expose session
+ *  tickets, so keeping the connection warm is how handshakes are saved.
+ * ===================================================================== */
+
+class HttpConnection {
+public:
+  HttpConnection(WiFiClient& client, DnsCache& dns, const char* host, uint16_t port, bool tls, unsigned long keepAliveMs)
+    : client_(client), dns_(dns), host_(host), port_(port), tls_(tls), keepAliveMs_(keepAliveMs) {}
+
+  /* Send a request and read the whole response, keeping the first
+     replySize - 1 bytes of the body in reply (may be nullptr).  Returns
+     the HTTP status, or 0 if there was no response. */
+  int request(const char* method, const char* path, const char* contentType, const void* body, size_t length,
+              char* reply, size_t replySize, unsigned long timeoutMs) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+      if (!send(method, path, contentType, body, length)) {
+        if (reply) reply[0] = '\0';
+        return 0;
+      }
+
+      int status = receive(reply, replySize, timeoutMs);
+      // Retry only if the server had closed the reused connection before
+      // answering.  After a timeout, or once any of a response has
+      // arrived, it may have acted on the request, and a retry could
+      // post it twice.
+      if (status > 0 || !reused_ || received_ || !peerClosed_) return status;
+      staleRetries_++;
+    }
+    return 0;
+  }
+
+  /* Send a request without waiting for the response.  False if there
+     is no connection. */
+  bool send(const char* method, const char* path, const char* contentType, const void* body, size_t length) {
+    if (!open(reused_)) return false;
+
+    client_.print(method);
+    client_.print(" ");
+    client_.print(path);
+    client_.println(" HTTP/1.1");
+    client_.print("Host: ");
+    client_.println(host_);
+    if (body) {
+      client_.print("Content-Type: ");
+      client_.println(contentType);
+      client_.print("Content-Length: ");
+      client_.println(length);
+    }
+    client_.println();
+    if (body) client_.write((const uint8_t*)body, length);
+
+    received_ = false;
+    peerClosed_ = false;
+    requests_++;
+    return true;
+  }
+
+  /* More of the response to send() has arrived (or the connection
+     closed), so reading it won't wait long */
+  bool responseReady() {
+    return client_.available() > 0 || !client_.connected();
+  }
+
+  /* Read the response to send(); see request() */
+  int receive(char* reply, size_t replySize, unsigned long timeoutMs) {
+    if (reply) reply[0] = '\0';
+    int status = readResponse(reply, replySize, millis() + timeoutMs);
+    if (status > 0) {
+      usedAt_ = millis();
+    } else {
+      close();
+    }
+    return status;
+  }
+
+  /* Read the status line and headers of the response to send(), leaving
+     the body for readBodyLine().  Returns the HTTP status, or 0. */
+  int receiveHeaders(unsigned long timeoutMs) {
+    int status = readHeaders(millis() + timeoutMs);
+    if (body_ == BODY_FAILED) close();
+    return status;
+  }
+
+  /* Next line of the body, without the CRLF.  False once the body is
+     over, or on a timeout; bodyComplete() tells which.  The connection
+     is kept for reuse only if the whole body was read. */
+  bool readBodyLine(char* buf, size_t size, unsigned long timeoutMs) {
+    unsigned long deadline = millis() + timeoutMs;
+    size_t len = 0;
+    int c;
+    while ((c = bodyByte(deadline)) >= 0) {
+      if (c == '\n') {
+        buf[len] = '\0';
+        return true;
+      }
+      if (c != '\r' && len < size - 1) buf[len++] = c;
+    }
+    buf[len] = '\0';
+    endResponse();
+    return len > 0 && body_ == BODY_DONE;  // a last line without a newline
+  }
+
+  bool bodyComplete() const { return body_ == BODY_DONE; }
+
+  /* Connect if not already connected, e.g. for a request read by hand */
+  bool open() {
+    bool reused;
+    return open(reused);
+  }
+
+  void close() {
+    client_.stop();
+    open_ = false;
+  }
+
+  /* Call from an idle state */
+  void poll() {
+    if (open_ && (!client_.connected() || millis() - usedAt_ > keepAliveMs_)) {
+      close();
+    }
+  }
+
+  WiFiClient& client() { return client_; }
+
+  void printStats(Stream& out) const {
+    out.print("[HTTP] tls=");
+    out.print(tls_);
+    out.print(" requests=");
+    out.print(requests_);
+    out.print(" reused=");
+    out.print(reuses_);
+    out.print(" stale_retries=");
+    out.println(staleRetries_);
+    connects_.print(out, tls_ ? "[HTTP] tls_handshakes" : "[HTTP] connects", "ms");
+  }
+
+private:
+  WiFiClient& client_;
+  DnsCache& dns_;
+  const char* host_;
+  uint16_t port_;
+  bool tls_;
+  unsigned long keepAliveMs_;
+  bool open_ = false;
+  bool reused_ = false;  // the last send() went out on an existing connection
+  unsigned long usedAt_ = 0;
+  bool received_ = false;    // some of the response to the last send() has arrived
+  bool peerClosed_ = false;  // the server closed the connection while it was being read
+
+  // Framing of the response being read
+  enum BodyState : uint8_t { BODY_READING, BODY_DONE, BODY_FAILED };
+  BodyState body_ = BODY_DONE;
+  bool chunked_ = false;
+  bool untilClose_ = false;  // no length given; the body ends when the server closes
+  bool firstChunk_ = true;
+  bool keepOpen_ = true;
+  long remaining_ = 0;       // bytes left in the body, or in the current chunk
+
+  uint32_t requests_ = 0;
+  uint32_t reuses_ = 0;
+  uint32_t staleRetries_ = 0;
+  LatencyStats connects_;  // connect time, including the TLS handshake
+
+  bool open(bool& reused) {
+    reused = open_ && client_.connected();
+    if (reused) {
+      reuses_++;
+      return true;
+    }
+
+    client_.stop();
+    unsigned long start = millis();
+    open_ = connect();
+    connects_.add(millis() - start, open_);
+    usedAt_ = millis();
+    return open_;
+  }
+
+  bool connect(int maxRetries = 3, int initialDelayMs = 2) {
+    STALL_REGION(STALL_SITE_CONNECT);
+    IPAddress ip;
+    if (!tls_ && !dns_.resolve(ip)) {
+      LOG_ERROR("Could not resolve server address!");
+      return false;
+    }
+
+    int delayMs = initialDelayMs;
+
+    for (int attempt = 1; attempt <= maxRetries; attempt++) {
+      if (tls_ ? client_.connect(host_, port_) : client_.connect(ip, port_)) {
+        return true;
+      }
+
+      LOG_WARN("Connection failed. Backing off for %dms...", delayMs);
+      delay(delayMs);
+      delayMs *= 2;  // Exponential backoff
+    }
+
+    LOG_ERROR("All connection attempts failed!");
+    if (!tls_) dns_.invalidate();  // the address may have moved
+    return false;
+  }
+
+  int readResponse(char* reply, size_t replySize, unsigned long deadline) {
+    int status = readHeaders(deadline);
+    size_t stored = 0;
+    int c;
+    while ((c = bodyByte(deadline)) >= 0) {
+      if (reply && stored < replySize - 1) reply[stored++] = c;
+    }
+    if (reply) reply[stored] = '\0';
+    endResponse();
+    return status;
+  }
+
+  int readHeaders(unsigned long deadline) {
+    body_ = BODY_FAILED;
+    char line[64];
+    if (!readLine(line, sizeof(line), deadline) || strncmp(line, "HTTP/1.", 7) != 0) return 0;
+    int status = atoi(line + 9);
+
+    long contentLength = -1;
+    chunked_ = false;
+    keepOpen_ = true;
+    bool headersDone = false;
+    while (readLine(line, sizeof(line), deadline)) {
+      if (line[0] == '\0') {
+        headersDone = true;
+        break;
+      }
+      if (strncasecmp(line, "Content-Length:", 15) == 0) {
+        contentLength = atol(line + 15);
+      } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0 && strstr(line + 18, "chunked")) {
+        chunked_ = true;
+      } else if (strncasecmp(line, "Connection:", 11) == 0 && strstr(line + 11, "close")) {
+        keepOpen_ = false;
+      }
+    }
+    if (!headersDone) return status;
+    if (status >= 100 && status < 200) return readHeaders(deadline);  // interim; the real response follows
+
+    if (status == 204 || status == 304) {  // never a body, whatever the headers say
+      chunked_ = false;
+      contentLength = 0;
+    }
+    untilClose_ = !chunked_ && contentLength < 0;
+    if (untilClose_) keepOpen_ = false;
+    remaining_ = chunked_ ? 0 : untilClose_ ? LONG_MAX : contentLength;
+    firstChunk_ = true;
+    body_ = BODY_READING;
+    return status;
+  }
+
+  // Next byte of the body, or -1 once it's over (body_ says how)
+  int bodyByte(unsigned long deadline) {
+    if (body_ != BODY_READING) return -1;
+    if (remaining_ == 0 && !nextChunk(deadline)) return -1;
+
+    int c = readByte(deadline);
+    if (c < 0) {
+      body_ = untilClose_ && !client_.connected() ? BODY_DONE : BODY_FAILED;
+      return -1;
+    }
+    remaining_--;
+    return c;
+  }
+
+  // At the end of the body or of a chunk.  False, with body_ set, if the body is over.
+  bool nextChunk(unsigned long deadline) {
+    if (!chunked_) {
+      body_ = BODY_DONE;
+      return false;
+    }
+
+    char line[16];
+    // The CRLF after the previous chunk, then the next chunk's size
+    if ((!firstChunk_ && !readLine(line, sizeof(line), deadline)) || !readLine(line, sizeof(line), deadline)) {
+      body_ = BODY_FAILED;
+      return false;
+    }
+    firstChunk_ = false;
+    remaining_ = strtol(line, nullptr, 16);
+    if (remaining_ > 0) return true;
+
+    // Last chunk.  Trailers, up to the blank line that ends the response
+    body_ = BODY_FAILED;
+    while (readLine(line, sizeof(line), deadline)) {
+      if (line[0] == '\0') {
+        body_ = BODY_DONE;
+        break;
+      }
+    }
+    return false;
+  }
+
+  // Keep the connection only if the response was read to its end
+  void endResponse() {
+    if (body_ != BODY_DONE || !keepOpen_) {
+      close();
+    } else {
+      usedAt_ = millis();
+    }
+  }
+
+  // One line without the CRLF.  False if the connection closes or the deadline passes first.
+  bool readLine(char* buf, size_t size, unsigned long deadline) {
+    size_t len = 0;
+    int c;
+    while ((c = readByte(deadline)) >= 0) {
+      if (c == '\n') {
+        buf[len] = '\0';
+        return true;
+      }
+      if (c != '\r' && len < size - 1) buf[len++] = c;
+    }
+    buf[len] = '\0';
+    return false;
+  }
+
+  int readByte(unsigned long deadline) {
+    while ((long)(deadline - millis()) > 0) {
+      if (client_.available()) {
+        received_ = true;
+        return client_.read();
+      }
+      if (!client_.connected()) {
+        peerClosed_ = true;
+        break;
+      }
+    }
+    return -1;
+  }
+};
+
+#endif
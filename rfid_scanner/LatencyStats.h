@@ -0,0 +1,48 @@
+#ifndef LATENCY_STATS_H
+#define LATENCY_STATS_H
+
+#include <Arduino.h>
+
+// Count, failures and last/avg/max duration of a repeated operation.
+class LatencyStats {
+public:
+  void add(unsigned long duration, bool ok = true) {
+    count_++;
+    if (!ok) failures_++;
+    last_ = duration;
+    total_ += duration;
+    if (duration > max_) max_ = duration;
+  }
+
+  uint32_t count() const { return count_; }
+  uint32_t failures() const { return failures_; }
+  unsigned long last() const { return last_; }
+  unsigned long avg() const { return count_ ? total_ / count_ : 0; }
+  unsigned long max() const { return max_; }
+
+  /* e.g. "[Upload] count=12 failures=0 ms(last/avg/max)=80/95/210" */
+  void print(Stream& out, const char* label, const char* unit) const {
+    out.print(label);
+    out.print(" count=");
+    out.print(count_);
+    out.print(" failures=");
+    out.print(failures_);
+    out.print(" ");
+    out.print(unit);
+    out.print("(last/avg/max)=");
+    out.print(last_);
+    out.print("/");
+    out.print(avg());
+    out.print("/");
+    out.println(max_);
+  }
+
+private:
+  uint32_t count_ = 0;
+  uint32_t failures_ = 0;
+  unsigned long last_ = 0;
+  uint64_t total_ = 0;
+  unsigned long max_ = 0;
+};
+
+#endif
@@ -0,0 +1,86 @@
+#include "Log.h"
+
+Logger logger;
+
+static const char* const levelNames[] = { "D ", "I ", "W ", "E " };
+
+void Logger::push(const Record& r) {
+  uint16_t head = head_;
+  if ((uint16_t)(head - tail_) >= LOG_RING_SIZE) {
+    dropped_++;
+    return;
+  }
+
+  ring_[head & (LOG_RING_SIZE - 1)] = r;
+  __asm__ volatile("" ::: "memory");  // record is complete before it's published
+  head_ = head + 1;
+
+  uint16_t depth = head + 1 - tail_;
+  if (depth > highWater_) highWater_ = depth;
+}
+
+int Logger::drain(Stream& out, int maxRecords) {
+  int printed = 0;
+  while (printed < maxRecords && tail_ != head_) {
+    // A formatted record rarely exceeds this; waiting for room keeps print() from blocking
+    if (out.availableForWrite() < 64) break;
+
+    uint16_t tail = tail_;
+    print(ring_[tail & (LOG_RING_SIZE - 1)], out);
+    __asm__ volatile("" ::: "memory");
+    tail_ = tail + 1;
+    printed++;
+  }
+  return printed;
+}
+
+void Logger::add(Record& r, const char* s) {
+  strncpy(r.text, s ? s : "", LOG_TEXT_SIZE - 1);
+  r.text[LOG_TEXT_SIZE - 1] = '\0';
+}
+
+void Logger::print(const Record& r, Print& out) {
+  out.print(r.at);
+  out.print(' ');
+  out.print(levelNames[r.level < 4 ? r.level : 3]);
+
+  uint8_t arg = 0;
+  for (const char* p = r.fmt; *p; ++p) {
+    if (*p != '%') {
+      out.print(*p);
+      continue;
+    }
+
+    ++p;
+    while (*p == 'l') ++p;  // ints are 32 bits either way
+    if (*p == '\0') break;
+
+    int32_t v = arg < r.nargs ? r.args[arg] : 0;
+    switch (*p) {
+      case 'd':
+      case 'i':
+        out.print((long)v);
+        arg++;
+        break;
+      case 'u':
+        out.print((unsigned long)(uint32_t)v);
+        arg++;
+        break;
+      case 'x':
+        out.print((unsigned long)(uint32_t)v, HEX);
+        arg++;
+        break;
+      case 'c':
+        out.print((char)v);
+        arg++;
+        break;
+      case 's':
+        out.print(r.text);
+        break;
+      default:
+        out.print(*p);
+        break;
+    }
+  }
+  out.println();
+}
@@ -0,0 +1,131 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <Arduino.h>
+
+/* =====================================================================
+ *  Log.h — deferred, levelled logging for the hot paths
+ *
+ *    LOG_INFO("Scanned tag %s", uid);
+ *
+ *  Calls below LOG_LEVEL compile to nothing.  The rest store a small
+ *  binary record (format pointer, up to 3 integer args, one copied
+ *  string arg) in a ring buffer; drain() formats and prints them from
+ *  loop() only while the serial port can take the bytes without
+ *  blocking.  When the ring is full, records are dropped and counted.
+ *
+ *  Format strings must be literals (they stay in flash; only the pointer
+ *  is stored).  Supported: %d %i %u %ld %lu %x %c %s %%.
+ *
+ *  Single producer: only log from loop() context, not from ISRs.
+ * ===================================================================== */
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_NONE 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Set to 0 to print immediately instead of deferring, e.g. to compare loop times
+#ifndef LOG_DEFERRED
+#define LOG_DEFERRED 1
+#endif
+
+#define LOG_RING_SIZE 32  // records; must be a power of 2
+#define LOG_TEXT_SIZE 24  // bytes kept of a %s argument, including terminator
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) logger.write(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...) logger.write(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(...) logger.write(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) logger.write(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) do {} while (0)
+#endif
+
+class Logger {
+public:
+  struct Record {
+    uint32_t at;
+    const char* fmt;
+    int32_t args[3];
+    char text[LOG_TEXT_SIZE];
+    uint8_t level;
+    uint8_t nargs;
+  };
+
+  template <typename... Args>
+  void write(uint8_t level, const char* fmt, const Args&... args) {
+    Record r;
+    r.at = millis();
+    r.fmt = fmt;
+    r.level = level;
+    r.nargs = 0;
+    r.text[0] = '\0';
+    pack(r, args...);
+
+#if LOG_DEFERRED
+    push(r);
+#else
+    print(r, Serial);
+#endif
+  }
+
+  /* Print queued records while out has room for them.  Returns the number
+     of records printed. */
+  int drain(Stream& out, int maxRecords = 2);
+
+  uint32_t dropped() const { return dropped_; }
+  uint16_t depth() const { return (uint16_t)(head_ - tail_); }
+  uint16_t highWater() const { return highWater_; }
+
+private:
+  Record ring_[LOG_RING_SIZE];
+  volatile uint16_t head_ = 0;  // written by the producer only
+  volatile uint16_t tail_ = 0;  // written by drain() only
+  uint16_t highWater_ = 0;
+  uint32_t dropped_ = 0;
+
+  void push(const Record& r);
+  void print(const Record& r, Print& out);
+
+  void pack(Record&) {}
+
+  template <typename T, typename... Rest>
+  void pack(Record& r, const T& v, const Rest&... rest) {
+    add(r, v);
+    pack(r, rest...);
+  }
+
+  template <typename T>
+  void add(Record& r, const T& v) {
+    if (r.nargs < 3) r.args[r.nargs++] = (int32_t)v;
+  }
+
+  void add(Record& r, const char* s);
+  void add(Record& r, char* s) { add(r, (const char*)s); }
+  void add(Record& r, const String& s) { add(r, s.c_str()); }
+};
+
+extern Logger logger;
+
+#endif
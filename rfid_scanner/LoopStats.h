@@ -0,0 +1,35 @@
+#ifndef LOOP_STATS_H
+#define LOOP_STATS_H
+
+#include <Arduino.h>
+
+// Loop iteration timing, in microseconds, over a reporting window.
+class LoopStats {
+public:
+  void begin() { startedAt_ = micros(); }
+
+  void end() {
+    unsigned long us = micros() - startedAt_;
+    count_++;
+    totalUs_ += us;
+    if (us > maxUs_) maxUs_ = us;
+  }
+
+  uint32_t count() const { return count_; }
+  uint32_t avgUs() const { return count_ ? totalUs_ / count_ : 0; }
+  uint32_t maxUs() const { return maxUs_; }
+
+  void reset() {
+    count_ = 0;
+    totalUs_ = 0;
+    maxUs_ = 0;
+  }
+
+private:
+  unsigned long startedAt_ = 0;
+  uint32_t count_ = 0;
+  uint64_t totalUs_ = 0;
+  uint32_t maxUs_ = 0;
+};
+
+#endif
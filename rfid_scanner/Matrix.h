@@ -26,6 +26,7 @@ private:
   void displayFrame();
   void addToFrame(char c, int pos);
 
+  friend void run_benchmarks();
 
 public:
   Matrix();
@@ -0,0 +1,309 @@
+#ifndef MQTT_TRANSPORT_H
+#define MQTT_TRANSPORT_H
+
+#include <Arduino.h>
+#include <WiFiS3.h>
+#include <ArduinoMqttClient.h>  // External: https://github.com/arduino-libraries/ArduinoMqttClient v0.1.8
+#include "Log.h"
+#include "LatencyStats.h"
+#include "StallWatch.h"
+
+/* =====================================================================
+ *  MqttTransport.h — scans and health over one persistent MQTT session
+ *
+ *    atm/<loc>/scans    one QoS 1 message per scan: {"id":"<uid>","loc":<loc>}
+ *    atm/<loc>/status   retained: {"l":<loc>,"online":true,...} while up,
+ *                       replaced by the will {"l":<loc>,"online":false}
+ *                       when the broker loses the keepalive
+ *
+ *  endMessage() only means the message was written to the socket; the
+ *  library never reports the broker's PUBACK.  MqttAckTap sits between
+ *  the library and the socket and counts the PUBACKs going by.  A broker
+ *  acks QoS 1 messages in the order it got them, so each PUBACK settles
+ *  the oldest message in flight.  Scans stay queued until takeAcked()
+ *  hands back their count; scans still in flight when the session drops
+ *  are published again after the reconnect (at least once, as QoS 1
+ *  promises).  If no PUBACK comes for MQTT_ACK_TIMEOUT_MS the session is
+ *  taken as dead and dropped.
+ *
+ *  poll() keeps the session alive and is cheap enough for every loop.
+ *  reconnect() blocks for the TCP connect and up to
+ *  MQTT_CONNECT_TIMEOUT_MS for the broker's CONNACK, so call it only
+ *  while idle.  Failed attempts back off from MQTT_RECONNECT_MS,
+ *  doubling up to MQTT_RECONNECT_MAX_MS, so a missing broker costs
+ *  one connect attempt per interval rather than one per scan.
+ * ===================================================================== */
+
+#define MQTT_RECONNECT_MS 5000
+#define MQTT_RECONNECT_MAX_MS 60000
+#define MQTT_CONNECT_TIMEOUT_MS 2000  // the library's default is 30 s
+#define MQTT_ACK_TIMEOUT_MS 10000
+#define MQTT_IN_FLIGHT_MAX 32          // one bit each in MqttTransport::scanBits_
+
+/* A Client that passes everything through to the socket and counts the
+   PUBACK packets in what the broker sends. */
+class MqttAckTap : public Client {
+public:
+  explicit MqttAckTap(Client& net) : net_(net) {}
+
+  /* Number of PUBACKs since the last call */
+  uint16_t takePubacks() {
+    uint16_t n = pubacks_;
+    pubacks_ = 0;
+    return n;
+  }
+
+  int connect(IPAddress ip, uint16_t port) override { reset(); return net_.connect(ip, port); }
+  int connect(const char* host, uint16_t port) override { reset(); return net_.connect(host, port); }
+  size_t write(uint8_t b) override { return net_.write(b); }
+  size_t write(const uint8_t* buf, size_t size) override { return net_.write(buf, size); }
+  int available() override { return net_.available(); }
+  int peek() override { return net_.peek(); }
+  void flush() override { net_.flush(); }
+  void stop() override { net_.stop(); }
+  uint8_t connected() override { return net_.connected(); }
+  operator bool() override { return (bool)net_; }
+
+  int read() override {
+    int b = net_.read();
+    if (b >= 0) feed(b);
+    return b;
+  }
+
+  int read(uint8_t* buf, size_t size) override {
+    int n = net_.read(buf, size);
+    for (int i = 0; i < n; i++) feed(buf[i]);
+    return n;
+  }
+
+private:
+  enum State : uint8_t { HEADER, LENGTH, BODY };
+
+  Client& net_;
+  State state_ = HEADER;
+  uint8_t type_ = 0;
+  uint32_t remaining_ = 0;
+  uint32_t multiplier_ = 1;
+  uint16_t pubacks_ = 0;
+
+  void reset() {
+    state_ = HEADER;
+    pubacks_ = 0;
+  }
+
+  // Walks the packet framing: fixed header byte, remaining length
+  // (7 bits a byte, high bit = more), then that many bytes of body
+  void feed(uint8_t b) {
+    switch (state_) {
+      case HEADER:
+        type_ = b >> 4;
+        remaining_ = 0;
+        multiplier_ = 1;
+        state_ = LENGTH;
+        break;
+      case LENGTH:
+        remaining_ += (b & 0x7f) * multiplier_;
+        multiplier_ *= 128;
+        if (b & 0x80) break;
+        if (type_ == 4) pubacks_++;  // PUBACK
+        state_ = remaining_ > 0 ? BODY : HEADER;
+        break;
+      case BODY:
+        if (--remaining_ == 0) state_ = HEADER;
+        break;
+    }
+  }
+};
+
+class MqttTransport {
+public:
+  MqttTransport(const char* broker, uint16_t port, int location, unsigned long keepAliveMs)
+    : tap_(net_), mqtt_(tap_), broker_(broker), port_(port), location_(location), keepAliveMs_(keepAliveMs) {
+    snprintf(scanTopic_, sizeof(scanTopic_), "atm/%d/scans", location);
+    snprintf(statusTopic_, sizeof(statusTopic_), "atm/%d/status", location);
+  }
+
+  void poll() {
+    if (!mqtt_.connected()) return;
+    mqtt_.poll();  // keepalive pings, and reads the PUBACKs
+    settle(tap_.takePubacks());
+    if (inFlight_ > 0 && millis() - ackWaitAt_ > MQTT_ACK_TIMEOUT_MS) {
+      ackTimeouts_++;
+      LOG_WARN("[MQTT] no PUBACK for %lums, dropping the session", millis() - ackWaitAt_);
+      net_.stop();  // not mqtt_.stop(): a clean DISCONNECT would discard the will
+    }
+  }
+
+  /* Connect if the session is down and the backoff has passed */
+  void reconnect() {
+    if (mqtt_.connected() || WiFi.status() != WL_CONNECTED) return;
+    if (attempted_ && millis() - attemptAt_ < backoffMs_) return;
+    connect();
+  }
+
+  bool connected() { return mqtt_.connected(); }
+
+  /* Publish one scan at QoS 1.  Returns false if not connected, or too
+     many messages are waiting on their PUBACK. */
+  bool publishScan(const char* json, size_t length) {
+    if (!mqtt_.connected() || inFlight_ >= MQTT_IN_FLIGHT_MAX) {
+      scans_.add(0, false);
+      return false;
+    }
+
+    unsigned long start = micros();
+    bool ok = publish(scanTopic_, json, length, false, true);
+    scans_.add(micros() - start, ok);
+    return ok;
+  }
+
+  /* Replace the retained status message. */
+  bool publishStatus(const char* json, size_t length) {
+    if (!mqtt_.connected() || inFlight_ >= MQTT_IN_FLIGHT_MAX) return false;
+    return publish(statusTopic_, json, length, true, false);
+  }
+
+  /* Scans the broker has acked since the last call, oldest first; the
+     caller can now drop them from its queue. */
+  uint16_t takeAcked() {
+    uint16_t n = acked_;
+    acked_ = 0;
+    return n;
+  }
+
+  /* Scans published and waiting on their PUBACK.  They follow the
+     takeAcked() ones in the caller's queue. */
+  uint16_t scansInFlight() const { return scansInFlight_; }
+
+  /* The caller's queue dropped its oldest scan to make room. */
+  void forgetOldest() {
+    if (acked_ > 0) {
+      acked_--;
+    } else if (scansInFlight_ > 0) {
+      scansInFlight_--;
+      skip_++;  // its PUBACK settles nothing
+    }
+  }
+
+  void printStats(Stream& out) const {
+    out.print("[MQTT] broker=");
+    out.print(broker_);
+    out.print(" connects=");
+    out.print(connects_.count() - connects_.failures());
+    out.print("/");
+    out.print(connects_.count());
+    out.print(" connect_ms(last)=");
+    out.print(connects_.last());
+    out.print(" in_flight=");
+    out.print(inFlight_);
+    out.print(" resent=");
+    out.print(resent_);
+    out.print(" ack_timeouts=");
+    out.println(ackTimeouts_);
+    scans_.print(out, "[MQTT] scans", "publish_us");
+  }
+
+private:
+  WiFiClient net_;
+  MqttAckTap tap_;
+  MqttClient mqtt_;
+  const char* broker_;
+  uint16_t port_;
+  int location_;
+  unsigned long keepAliveMs_;
+
+  char id_[24];
+  char scanTopic_[24];
+  char statusTopic_[24];
+
+  bool attempted_ = false;
+  unsigned long attemptAt_ = 0;
+  unsigned long backoffMs_ = 0;  // 0 = the last attempt didn't fail
+  LatencyStats connects_;
+  LatencyStats scans_;
+
+  // QoS 1 messages waiting on their PUBACK, oldest in bit 0 of scanBits_
+  uint8_t inFlight_ = 0;
+  uint32_t scanBits_ = 0;          // 1 = a scan, 0 = a status message
+  uint16_t scansInFlight_ = 0;     // scans in flight, less skip_
+  uint16_t skip_ = 0;              // in-flight scans the caller no longer holds
+  uint16_t acked_ = 0;
+  unsigned long ackWaitAt_ = 0;    // last publish into an empty window, or last PUBACK
+  uint32_t resent_ = 0;
+  uint32_t ackTimeouts_ = 0;
+
+  bool publish(const char* topic, const char* json, size_t length, bool retain, bool scan) {
+    mqtt_.beginMessage(topic, length, retain, 1);
+    mqtt_.write((const uint8_t*)json, length);
+    if (mqtt_.endMessage() != 1) return false;
+
+    if (inFlight_ == 0) ackWaitAt_ = millis();
+    if (scan) {
+      scanBits_ |= 1UL << inFlight_;
+      scansInFlight_++;
+    }
+    inFlight_++;
+    return true;
+  }
+
+  void settle(uint16_t pubacks) {
+    for (; pubacks > 0 && inFlight_ > 0; pubacks--) {
+      bool scan = scanBits_ & 1;
+      scanBits_ >>= 1;
+      inFlight_--;
+      ackWaitAt_ = millis();
+      if (!scan) continue;
+      if (skip_ > 0) {
+        skip_--;
+      } else {
+        scansInFlight_--;
+        acked_++;
+      }
+    }
+  }
+
+  void connect() {
+    STALL_REGION(STALL_SITE_CONNECT);
+    attempted_ = true;
+    attemptAt_ = millis();
+
+    // Whatever was in flight on the old session is published again
+    resent_ += scansInFlight_;
+    inFlight_ = 0;
+    scanBits_ = 0;
+    scansInFlight_ = 0;
+    skip_ = 0;
+
+    // The location alone isn't unique: two stations sharing a client id
+    // keep kicking each other off the broker
+    uint8_t mac[6];
+    WiFi.macAddress(mac);
+    snprintf(id_, sizeof(id_), "atm-%d-%02x%02x%02x%02x%02x%02x",
+             location_, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+    mqtt_.setId(id_);
+    mqtt_.setKeepAliveInterval(keepAliveMs_);
+    // The library keeps no QoS 1 state of its own to resume, so start
+    // clean; unacked scans are resent from the caller's queue instead
+    mqtt_.setCleanSession(true);
+    mqtt_.setConnectionTimeout(MQTT_CONNECT_TIMEOUT_MS);
+
+    char will[32];
+    int willLength = snprintf(will, sizeof(will), "{\"l\":%d,\"online\":false}", location_);
+    mqtt_.beginWill(statusTopic_, willLength, true, 1);
+    mqtt_.print(will);
+    mqtt_.endWill();
+
+    bool ok = mqtt_.connect(broker_, port_);
+    connects_.add(millis() - attemptAt_, ok);
+    if (!ok) {
+      backoffMs_ = backoffMs_ == 0 ? MQTT_RECONNECT_MS : min(backoffMs_ * 2, (unsigned long)MQTT_RECONNECT_MAX_MS);
+      LOG_WARN("[MQTT] connect failed, error %d, retrying in %lums", mqtt_.connectError(), backoffMs_);
+      return;
+    }
+    backoffMs_ = 0;
+    LOG_INFO("[MQTT] connected as %s", id_);
+  }
+};
+
+#endif
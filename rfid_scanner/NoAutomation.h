@@ -11,7 +11,7 @@ public:
   }
 
   void run(DoneCb cb) override {
-    Serial.println("[Action] no automation started");
+    LOG_INFO("[Action] no automation started");
     doneCb_ = cb;  // Save the callback to be called in update()
     active_ = true;
     runAt_ = millis();
@@ -22,14 +22,13 @@ public:
       return;
     }
 
-    if (runAt_ > 0) {
-      int elapsed = millis() - runAt_;
-      if (elapsed < 3000) {
-          return;
-      }
+    // Unsigned subtraction stays correct when millis() wraps
+    unsigned long elapsed = millis() - runAt_;
+    if (elapsed < 3000) {
+      return;
     }
 
-    Serial.println("[Action] no automation done");
+    LOG_INFO("[Action] no automation done");
     if (doneCb_) {
       DoneCb cb = doneCb_;
       doneCb_ = nullptr;
@@ -44,10 +43,12 @@ public:
     runAt_ = 0;
   }
 
+  const char* name() const override { return "NoAutomation"; }
+
 private:
   DoneCb doneCb_ = nullptr;
   bool active_ = false;
-  unsigned long runAt_;
+  unsigned long runAt_ = 0;
 };
 
 #endif
@@ -0,0 +1,201 @@
+#ifndef READER_TUNER_H
+#define READER_TUNER_H
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <MFRC522.h>
+#include "Log.h"
+
+/* =====================================================================
+ *  ReaderTuner.h — MFRC522 receiver gain and poll interval, tuned from
+ *  how reads actually go at this station
+ *
+ *  Every tag that answers a request is a read attempt; it succeeds if
+ *  its UID is read.  Enclosures and metal mounts show up as attempts
+ *  that fail (partial reads) and slow detect-to-UID times.
+ *
+ *    • gain: after each window of READER_TUNE_WINDOW attempts, the
+ *      success rate at the current gain is folded into that gain's
+ *      average.  Below READER_TUNE_TARGET_PCT the tuner tries the next
+ *      untried gain step (up first), then settles on the best one seen.
+ *      Gains stay between the MFRC522 default (33 dB) and its max (48 dB).
+ *    • poll interval: a partial read means a tag is in the field but
+ *      badly placed, so the reader polls again right away and shortens
+ *      the interval; clean windows lengthen it again, up to
+ *      READER_POLL_MAX_MS, to give the rest of the loop more time.
+ *
+ *  Both settings are saved to EEPROM when they change, so a station
+ *  starts from what worked last time.
+ * ===================================================================== */
+
+#define READER_TUNE_WINDOW 20       // read attempts per evaluation
+#define READER_TUNE_TARGET_PCT 95   // success rate to aim for
+#define READER_POLL_MAX_MS 20
+
+class ReaderTuner {
+public:
+  ReaderTuner(MFRC522& reader, int eepromAddr)
+    : reader_(reader), eepromAddr_(eepromAddr) {}
+
+  /* Load and apply the saved settings.  Call after PCD_Init(). */
+  void begin() {
+    Record r;
+    EEPROM.get(eepromAddr_, r);
+    if (r.magic == MAGIC && r.gain < GAIN_COUNT && r.pollMs <= READER_POLL_MAX_MS) {
+      gain_ = r.gain;
+      pollMs_ = r.pollMs;
+    }
+    for (uint8_t i = 0; i < GAIN_COUNT; i++) rate_[i] = -1;
+    apply();
+
+    Serial.print("Reader gain ");
+    Serial.print(GAIN_DB[gain_]);
+    Serial.print("dB, poll interval ");
+    Serial.print(pollMs_);
+    Serial.println("ms");
+  }
+
+  /* True when it's time to poll for tags again */
+  bool pollDue() {
+    if (!retryNow_ && millis() - polledAt_ < pollMs_) return false;
+    retryNow_ = false;
+    polledAt_ = millis();
+    return true;
+  }
+
+  /* Results of one poll: tags read, and tags that answered but weren't read */
+  void addPoll(uint8_t reads, uint8_t partials) {
+    attempts_ += reads + partials;
+    successes_ += reads;
+    windowAttempts_ += reads + partials;
+    windowSuccesses_ += reads;
+    if (partials > 0) retryNow_ = true;
+
+    if (windowAttempts_ >= READER_TUNE_WINDOW) {
+      tune();
+    }
+  }
+
+  /* Time from the tag answering to its UID being read */
+  void addLatency(unsigned long us) {
+    uint8_t i = 0;
+    while (i < LATENCY_BUCKETS - 1 && us >= LATENCY_BOUNDS_US[i]) i++;
+    latency_[i]++;
+    if (us > maxLatencyUs_) maxLatencyUs_ = us;
+  }
+
+  void printStats(Stream& out) const {
+    out.print("[Reader] gain_db=");
+    out.print(GAIN_DB[gain_]);
+    out.print(" poll_ms=");
+    out.print(pollMs_);
+    out.print(" attempts=");
+    out.print(attempts_);
+    out.print(" success_pct=");
+    out.print(attempts_ ? 100.0f * successes_ / attempts_ : 100.0f, 1);
+    out.print(" gain_changes=");
+    out.println(gainChanges_);
+
+    out.print("[Reader] success_pct by gain:");
+    for (uint8_t i = 0; i < GAIN_COUNT; i++) {
+      out.print(" ");
+      out.print(GAIN_DB[i]);
+      out.print("dB=");
+      if (rate_[i] < 0) {
+        out.print("-");
+      } else {
+        out.print(rate_[i], 1);
+      }
+    }
+    out.println();
+
+    out.print("[Reader] detect_to_uid_ms <2/<5/<10/<20/>=20=");
+    for (uint8_t i = 0; i < LATENCY_BUCKETS; i++) {
+      if (i) out.print("/");
+      out.print(latency_[i]);
+    }
+    out.print(" max_us=");
+    out.println(maxLatencyUs_);
+  }
+
+private:
+  struct Record {
+    uint32_t magic;
+    uint8_t gain;    // index into GAINS
+    uint8_t pollMs;
+  };
+
+  static constexpr uint32_t MAGIC = 0x52440001;
+  static constexpr uint8_t GAIN_COUNT = 4;
+  // 33, 38, 43 and 48 dB: the MFRC522 default and the steps above it
+  static constexpr byte GAINS[GAIN_COUNT] = { MFRC522::RxGain_33dB, MFRC522::RxGain_38dB, MFRC522::RxGain_43dB, MFRC522::RxGain_48dB };
+  static constexpr uint8_t GAIN_DB[GAIN_COUNT] = { 33, 38, 43, 48 };
+  static constexpr float ALPHA = 0.3f;  // weight of the newest window
+  static constexpr uint8_t LATENCY_BUCKETS = 5;
+  static constexpr unsigned long LATENCY_BOUNDS_US[LATENCY_BUCKETS - 1] = { 2000, 5000, 10000, 20000 };
+
+  MFRC522& reader_;
+  int eepromAddr_;
+
+  uint8_t gain_ = 0;
+  uint8_t pollMs_ = 0;
+  bool retryNow_ = false;
+  unsigned long polledAt_ = 0;
+
+  float rate_[GAIN_COUNT];  // average success % per gain, -1 = untried
+  uint16_t windowAttempts_ = 0;
+  uint16_t windowSuccesses_ = 0;
+  uint32_t attempts_ = 0;
+  uint32_t successes_ = 0;
+  uint32_t gainChanges_ = 0;
+  uint32_t latency_[LATENCY_BUCKETS] = {};
+  unsigned long maxLatencyUs_ = 0;
+
+  void tune() {
+    float rate = 100.0f * windowSuccesses_ / windowAttempts_;
+    rate_[gain_] = rate_[gain_] < 0 ? rate : rate_[gain_] + ALPHA * (rate - rate_[gain_]);
+    bool clean = windowSuccesses_ == windowAttempts_;
+    windowAttempts_ = 0;
+    windowSuccesses_ = 0;
+
+    uint8_t pollMs = clean ? min(pollMs_ + 5, READER_POLL_MAX_MS) : pollMs_ / 2;
+    uint8_t gain = gain_;
+    if (rate_[gain_] < READER_TUNE_TARGET_PCT) {
+      gain = nextGain();
+    }
+
+    if (gain == gain_ && pollMs == pollMs_) return;
+
+    if (gain != gain_) {
+      LOG_INFO("[Reader] success %d%% at %ddB, trying %ddB", (int)rate_[gain_], GAIN_DB[gain_], GAIN_DB[gain]);
+      gain_ = gain;
+      gainChanges_++;
+      apply();
+    }
+    pollMs_ = pollMs;
+    save();
+  }
+
+  // The next gain up or down that hasn't been tried, else the best one seen
+  uint8_t nextGain() const {
+    if (gain_ + 1 < GAIN_COUNT && rate_[gain_ + 1] < 0) return gain_ + 1;
+    if (gain_ > 0 && rate_[gain_ - 1] < 0) return gain_ - 1;
+
+    uint8_t best = gain_;
+    for (uint8_t i = 0; i < GAIN_COUNT; i++) {
+      if (rate_[i] > rate_[best]) best = i;
+    }
+    return best;
+  }
+
+  void apply() {
+    reader_.PCD_SetAntennaGain(GAINS[gain_]);
+  }
+
+  void save() {
+    Record r = { MAGIC, gain_, pollMs_ };
+    EEPROM.put(eepromAddr_, r);
+  }
+};
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef SCAN_QUEUE_H
+#define SCAN_QUEUE_H
+
+#include <Arduino.h>
+
+// A scan waiting to be uploaded
+struct ScanEvent {
+  char uid[21];  // hex, UIDs are at most 10 bytes
+  uint32_t at;   // UTC seconds when scanned, 0 if the clock wasn't set
+  uint8_t data[30];    // payload from the tag's memory, see TagPayload.h
+  uint8_t dataLength;  // 0 if none
+};
+
+/* Fixed-size FIFO of scans waiting to be uploaded.  When full, the
+   oldest scan is dropped to make room, and counted. */
+template <size_t CAPACITY>
+class ScanQueue {
+public:
+  void push(const char* uid, uint32_t at, const uint8_t* data = nullptr, size_t dataLength = 0) {
+    if (full()) {
+      drop(1);
+      _dropped++;
+    }
+    ScanEvent& e = _buf[(_head + _count) % CAPACITY];
+    strncpy(e.uid, uid, sizeof(e.uid) - 1);
+    e.uid[sizeof(e.uid) - 1] = '\0';
+    e.at = at;
+    e.dataLength = min(dataLength, sizeof(e.data));
+    if (e.dataLength > 0) memcpy(e.data, data, e.dataLength);
+    ++_count;
+  }
+
+  /* i-th oldest scan, i < size() */
+  const ScanEvent& peek(size_t i) const { return _buf[(_head + i) % CAPACITY]; }
+
+  /* Remove the n oldest scans, e.g. once they are uploaded. */
+  void drop(size_t n) {
+    if (n > _count) n = _count;
+    _head = (_head + n) % CAPACITY;
+    _count -= n;
+  }
+
+  bool   empty() const { return _count == 0; }
+  bool   full () const { return _count == CAPACITY; }
+  size_t size() const { return _count; }
+  uint32_t dropped() const { return _dropped; }
+
+private:
+  ScanEvent _buf[CAPACITY];
+  size_t _head = 0, _count = 0;
+  uint32_t _dropped = 0;
+};
+
+#endif
@@ -2,6 +2,7 @@
 #define DIGITAL_SIGNAL_AUTOMATION_H
 
 #include "Automation.h"
+#include "LatencyStats.h"
 #include <SoftwareSerial.h>
 #include <DYPlayerArduino.h>  // External: https://github.com/SnijderC/dyplayer (download zip and add manually)
 
@@ -9,6 +10,14 @@
 #define RX_PIN 4
 #define BUSY_PIN 3
 #define BAUD 9600
+#define SOUND_STOP_RETRY_MS 250  // resend stop if BUSY is still LOW after this
+
+// The next track is selected (without playing) while idle, so run() only
+// has to send play and the module has already found the file on the card.
+// If BUSY hasn't fallen PRECUE_VERIFY_MS after play, the track is started
+// the old way; if that works, pre-cueing is turned off for this module.
+#define PRECUE_SETTLE_MS 200   // after a stop, before selecting the next track
+#define PRECUE_VERIFY_MS 400
 
 class SoundAutomation : public Automation {
 public:
@@ -21,20 +30,36 @@ public:
     pinMode(BUSY_PIN, INPUT_PULLUP);  // BUSY from board; HIGH by default, LOW when playing
 
     mp3Serial.begin(BAUD);
-    delay(800);
-    player.begin();
 
-    numTracks = getNumberTracks();
-    Serial.print("Found number of tracks: ");
-    Serial.println(numTracks);
+    // The module needs time to power up, and counting tracks means playing
+    // each one briefly, so both run as a probe advanced by update().
+    probe = PROBE_POWER_UP;
+    probeAt = millis();
+    probeCount = 1;
+  }
 
-    player.setVolume(25);  // 0...30
+  bool ready() const override {
+    return probe == PROBE_DONE;
   }
 
   void run(DoneCb cb) override {
-    Serial.print("[Action] Playing track ");
-    Serial.println(track);
-    player.playSpecified(track);
+    if (probe != PROBE_DONE && probe != PROBE_PAUSED) {
+      LOG_WARN("[Action] scan during track probe, pausing probe");
+      pauseProbe();
+    }
+
+    runAt_ = millis();
+    if (precued_) {
+      LOG_INFO("[Action] Playing pre-cued track %d", track);
+      player.play();
+      start_ = START_PRECUED;
+    } else {
+      LOG_INFO("[Action] Playing track %d", track);
+      player.playSpecified(track);
+      start_ = START_DIRECT;
+    }
+    playing_ = track;
+    precued_ = false;
     doneCb_ = cb;
     active_ = true;
     track += 1;
@@ -44,12 +69,41 @@ public:
   }
 
   void update() override {
-    if (!active_) return;
+    if (probe != PROBE_DONE && probe != PROBE_PAUSED) {
+      updateProbe();
+      return;
+    }
+
+    if (stopping_) {
+      if (digitalRead(BUSY_PIN) == HIGH) {
+        stopping_ = false;
+        last = HIGH;  // so the next run() waits for BUSY to fall and rise again
+        schedulePrecue();
+      } else if (millis() - stopAt_ >= SOUND_STOP_RETRY_MS) {
+        player.stop();  // the module missed it; ask again
+        stopAt_ = millis();
+      }
+      return;
+    }
+
+    if (!active_) {
+      if (probe == PROBE_PAUSED) {
+        resumeProbe();
+      } else {
+        updatePrecue();
+      }
+      return;
+    }
 
     bool now = digitalRead(BUSY_PIN);
+    if (now != last) TRACE(TRACE_PIN, BUSY_PIN, now, 0);
+    if (start_ != START_NONE) {
+      updateStart(now);
+    }
     if (last == LOW && now == HIGH) { /* rising edge: LOW->HIGH */
-      Serial.println("Track finished");
+      LOG_INFO("Track finished");
       player.stop();
+      schedulePrecue();
       active_ = false;
       if (doneCb_) {
         DoneCb cb = doneCb_;  // copy in case cb restarts us
@@ -63,36 +117,175 @@ public:
   void cancel() override {
     if (!active_) return;
 
+    LOG_INFO("[Cancel] stopping track");
+    player.stop();
+    start_ = START_NONE;
+    active_ = false;
     doneCb_ = nullptr;
+    stopping_ = true;
+    stopAt_ = millis();
+  }
+
+  /* Idle once BUSY shows the track has stopped */
+  bool idle() const override { return !stopping_; }
+
+  const char* name() const override { return "SoundAutomation"; }
+
+  void printStats(Stream& out) override {
+    out.print("[Sound] precue=");
+    out.print(precueSupported_ ? "on" : "off (rejected)");
+    out.print(" precue_fallbacks=");
+    out.println(precueFallbacks_);
+    precuedStart_.print(out, "[Sound] scan_to_audio precued", "ms");
+    directStart_.print(out, "[Sound] scan_to_audio direct", "ms");
   }
 
 private:
   DoneCb doneCb_ = nullptr;
   bool active_ = false;
+  bool stopping_ = false;
+  unsigned long stopAt_ = 0;
   SoftwareSerial mp3Serial;
   DY::Player player;
   bool last = LOW;
   int track = 1;
   int numTracks = 1;
 
-  int getNumberTracks() {
-    player.setVolume(0);
-    delay(100);
+  // Pre-cue and play start
+  enum Start { START_NONE, START_DIRECT, START_PRECUED, START_FALLBACK };
+  Start start_ = START_NONE;      // waiting for BUSY to fall after run()
+  unsigned long runAt_ = 0;
+  int playing_ = 1;
+  bool precued_ = false;          // track is selected and waiting for play
+  bool precueDue_ = false;
+  unsigned long precueAt_ = 0;
+  bool precueSupported_ = true;
+  uint32_t precueFallbacks_ = 0;
+  LatencyStats precuedStart_;     // run() to BUSY falling, including fallbacks
+  LatencyStats directStart_;
 
-    int count = 1;
-    for (; count < 255; count++) {
-      player.playSpecified(count);
-      delay(500);
-      if (digitalRead(BUSY_PIN) == HIGH) {
+  // Select the next track once the module has settled after a stop
+  void schedulePrecue() {
+    precueDue_ = precueSupported_;
+    precueAt_ = millis();
+  }
+
+  void updatePrecue() {
+    if (!precueDue_ || millis() - precueAt_ < PRECUE_SETTLE_MS) return;
+    precueDue_ = false;
+    player.select(track);
+    precued_ = true;
+  }
+
+  // Time run() to audio, and fall back if the pre-cued play didn't start
+  void updateStart(bool busy) {
+    unsigned long elapsed = millis() - runAt_;
+    if (busy == LOW) {
+      if (start_ == START_FALLBACK) {
+        LOG_WARN("[Action] module ignored the pre-cued play, pre-cue off");
+        precueSupported_ = false;
+      }
+      (start_ == START_DIRECT ? directStart_ : precuedStart_).add(elapsed);
+      start_ = START_NONE;
+    } else if (start_ == START_PRECUED && elapsed >= PRECUE_VERIFY_MS) {
+      precueFallbacks_++;
+      player.playSpecified(playing_);
+      start_ = START_FALLBACK;
+    } else if (elapsed >= PRECUE_VERIFY_MS * 4) {
+      // No audio at all; the module itself is the problem, not the pre-cue
+      (start_ == START_DIRECT ? directStart_ : precuedStart_).add(elapsed, false);
+      start_ = START_NONE;
+    }
+  }
+
+  enum Probe { PROBE_POWER_UP, PROBE_MUTE, PROBE_PLAY, PROBE_CHECK, PROBE_GAP, PROBE_DONE, PROBE_PAUSED };
+  Probe probe = PROBE_DONE;
+  unsigned long probeAt = 0;
+  int probeCount = 1;
+
+  /* Count tracks by playing each one muted until BUSY stays HIGH.
+     Each step waits without blocking; update() calls this until done. */
+  void updateProbe() {
+    unsigned long elapsed = millis() - probeAt;
+
+    switch (probe) {
+      case PROBE_POWER_UP:
+        if (elapsed < 800) return;
+        player.begin();
+        player.setVolume(0);
+        probe = PROBE_MUTE;
+        break;
+
+      case PROBE_MUTE:
+        if (elapsed < 100) return;
+        probe = PROBE_PLAY;
+        break;
+
+      case PROBE_PLAY:
+        player.playSpecified(probeCount);
+        probe = PROBE_CHECK;
+        break;
+
+      case PROBE_CHECK:
+        if (elapsed < 500) return;
+        if (digitalRead(BUSY_PIN) == HIGH) {
+          finishProbe(probeCount - 1);
+          return;
+        }
         player.stop();
-        count -= 1;
+        probe = PROBE_GAP;
         break;
-      }
 
-      player.stop();
-      delay(500);
+      case PROBE_GAP:
+        if (elapsed < 500) return;
+        if (++probeCount >= 255) {
+          finishProbe(probeCount);
+          return;
+        }
+        probe = PROBE_PLAY;
+        break;
+
+      case PROBE_DONE:
+      case PROBE_PAUSED:
+        return;
     }
-    return count;
+    probeAt = millis();
+  }
+
+  /* A scan came in mid-probe.  Play it from the tracks found so far,
+     and pick the count up again at probeCount once it's done, so an
+     early tap can't leave the station with a short track list. */
+  void pauseProbe() {
+    if (probe == PROBE_POWER_UP) {
+      player.begin();
+    }
+    player.stop();
+    numTracks = max(probeCount - 1, 1);
+    player.setVolume(25);  // 0...30
+    probe = PROBE_PAUSED;
+  }
+
+  void resumeProbe() {
+    LOG_INFO("Resuming track probe at track %d", probeCount);
+    precueDue_ = false;
+    precued_ = false;
+    player.setVolume(0);
+    probe = PROBE_MUTE;
+    probeAt = millis();
+  }
+
+  void finishProbe(int count) {
+    if (probe == PROBE_POWER_UP) {
+      player.begin();
+    }
+    player.stop();
+
+    numTracks = max(count, 1);
+    probe = PROBE_DONE;
+    LOG_INFO("Found number of tracks: %d", numTracks);
+
+    player.setVolume(25);  // 0...30
+    schedulePrecue();
   }
 };
 
@@ -0,0 +1,103 @@
+#include "StallWatch.h"
+
+#include <WDT.h>
+#include <FspTimer.h>
+
+#define STALL_RECORD_MAGIC 0x5741544Cu  // "WATL"
+
+StallWatch stallWatch;
+
+// Not zeroed at startup, so it still holds what the last run wrote
+static StallWatch::Record noinitRecord __attribute__((section(".noinit")));
+
+static const char* const siteNames[STALL_SITE_COUNT] = {
+  "loop", "wifi", "connect", "dns", "upload", "health", "tag_sync",
+  "clock", "automation_run", "automation_update", "automation_cancel", "bench", "status",
+};
+
+static FspTimer stallTimer;
+
+static void onStallTimer(timer_callback_args_t*) {
+  stallWatch.tick();
+}
+
+uint32_t StallWatch::checksum(const Record& r) {
+  return r.magic ^ ((uint32_t)r.site << 8 | r.watchdog) ^ r.stallMs ^ (r.uptimeMs * 31);
+}
+
+void StallWatch::begin(uint32_t rebootMs, bool watchdog) {
+  rebootMs_ = rebootMs;
+  if (noinitRecord.magic == STALL_RECORD_MAGIC && noinitRecord.check == checksum(noinitRecord)) {
+    last_ = noinitRecord;
+    // Reset by the hardware watchdog rather than by tick()
+    if (R_SYSTEM->RSTSR1_b.WDTRF) last_.watchdog = 1;
+    // A normal reset (button, upload) also leaves the record behind; only
+    // keep it if the loop had actually stopped
+    hasRecord_ = last_.watchdog || last_.stallMs >= rebootMs;
+  }
+  noinitRecord.magic = 0;
+  R_SYSTEM->RSTSR1_b.WDTRF = 0;  // sticky until cleared
+  kickedAt_ = millis();
+  started_ = true;
+
+  if (!watchdog) return;
+  uint8_t type;
+  int8_t channel = FspTimer::get_available_timer(type);
+  if (channel < 0) return;  // no timer to feed it from, so leave the watchdog off
+  stallTimer.begin(TIMER_MODE_PERIODIC, type, channel, 1000.0f / STALL_TICK_MS, 0.0f, onStallTimer);
+  stallTimer.setup_overflow_irq();
+  stallTimer.open();
+  stallTimer.start();
+  WDT.begin(STALL_WDT_MS);
+}
+
+void StallWatch::tick() {
+  uint32_t stallMs = millis() - kickedAt_;
+
+  Record r;
+  r.magic = STALL_RECORD_MAGIC;
+  r.site = site_;
+  r.watchdog = 0;
+  r.stallMs = stallMs;
+  r.uptimeMs = millis();
+  r.check = checksum(r);
+  noinitRecord = r;
+
+  if (stallMs < rebootMs_) {
+    WDT.refresh();
+  } else {
+    NVIC_SystemReset();
+  }
+}
+
+const char* StallWatch::siteName(uint8_t site) {
+  return site < STALL_SITE_COUNT ? siteNames[site] : "?";
+}
+
+void StallWatch::print(Print& out) const {
+  out.print("[Stall] worst_gap_ms=");
+  out.print(worstGapMs_);
+  out.print(" (");
+  out.print(siteName(worstGapSite_));
+  out.print(")");
+  for (uint8_t i = 1; i < STALL_SITE_COUNT; i++) {
+    if (worstMs_[i] == 0) continue;
+    out.print(" ");
+    out.print(siteNames[i]);
+    out.print("=");
+    out.print(worstMs_[i]);
+  }
+  out.println();
+
+  if (hasRecord_) {
+    out.print("[Stall] last reset: ");
+    out.print(last_.watchdog ? "hardware watchdog" : "stall");
+    out.print(" in ");
+    out.print(siteName(last_.site));
+    out.print(" after ");
+    out.print(last_.stallMs);
+    out.print("ms, uptime ");
+    out.print(last_.uptimeMs / 1000);
+    out.println("s");
+  }
+}
@@ -0,0 +1,148 @@
+#ifndef STALL_WATCH_H
+#define STALL_WATCH_H
+
+#include <Arduino.h>
+
+/* =====================================================================
+ *  StallWatch.h — loop stall detection with blocking-call attribution
+ *
+ *    void track_scans_http() {
+ *      STALL_REGION(STALL_SITE_UPLOAD);
+ *      ...   // calls that may block the loop
+ *    }
+ *
+ *  loop() calls kick() every iteration.  A timer interrupt checks every
+ *  STALL_TICK_MS how long it has been since the last kick:
+ *    - while that's under rebootMs it feeds the hardware watchdog,
+ *      so a legitimately slow call (WiFi.begin() can take ~10 s, longer
+ *      than the R4's ~5.5 s hardware limit) doesn't reset the board
+ *    - past it, it saves a stall record and resets the board
+ *  If interrupts themselves stop, the hardware watchdog is left unfed and
+ *  resets the board on its own.
+ *
+ *  The stall record lives in .noinit RAM, which survives a reset, and is
+ *  also kept up to date on every tick so a hardware watchdog reset leaves
+ *  the last known site behind.  begin() picks it up; the next health
+ *  check reports it.
+ *
+ *  STALL_REGION marks the enclosing scope as a blocking call site.  The
+ *  worst time spent in each site is kept, as is the worst gap between
+ *  kicks.  Regions nest; the innermost one is blamed for a stall.
+ * ===================================================================== */
+
+#define STALL_WDT_MS 4000   // hardware watchdog timeout, at most ~5500 on the R4
+#define STALL_TICK_MS 100   // how often the timer interrupt checks the loop
+
+enum StallSite : uint8_t {
+  STALL_SITE_LOOP,  // not in any region
+  STALL_SITE_WIFI,
+  STALL_SITE_CONNECT,
+  STALL_SITE_DNS,
+  STALL_SITE_UPLOAD,
+  STALL_SITE_HEALTH,
+  STALL_SITE_TAG_SYNC,
+  STALL_SITE_CLOCK,
+  STALL_SITE_AUTOMATION_RUN,
+  STALL_SITE_AUTOMATION_UPDATE,
+  STALL_SITE_AUTOMATION_CANCEL,
+  STALL_SITE_BENCH,
+  STALL_SITE_STATUS,
+  STALL_SITE_COUNT
+};
+
+#define STALL_CONCAT_(a, b) a##b
+#define STALL_CONCAT(a, b) STALL_CONCAT_(a, b)
+#define STALL_REGION(site) BlockingRegion STALL_CONCAT(stallRegion_, __LINE__)(site)
+
+class StallWatch {
+public:
+  // Survives a reset in .noinit RAM
+  struct Record {
+    uint32_t magic;
+    uint8_t site;        // innermost region when the loop stopped
+    uint8_t watchdog;    // 1 if the hardware watchdog did the reset
+    uint32_t stallMs;    // time since the last kick
+    uint32_t uptimeMs;   // millis() at the time
+    uint32_t check;
+  };
+
+  /* Picks up any stall record left by the previous run, and, if
+     watchdog is set, starts the hardware watchdog and the timer that
+     feeds it. */
+  void begin(uint32_t rebootMs, bool watchdog);
+
+  void kick() {
+    uint32_t now = millis();
+    uint32_t gap = now - kickedAt_;
+    if (gap > worstGapMs_ && started_) {
+      worstGapMs_ = gap;
+      worstGapSite_ = slowSite_;
+    }
+    kickedAt_ = now;
+    slowSite_ = STALL_SITE_LOOP;
+    slowMs_ = 0;
+  }
+
+  uint8_t enter(uint8_t site) {
+    uint8_t outer = site_;
+    site_ = site;
+    return outer;
+  }
+
+  void leave(uint8_t site, uint8_t outer, uint32_t ms) {
+    if (ms > worstMs_[site]) worstMs_[site] = ms;
+    if (ms > slowMs_) {  // slowest call since the last kick
+      slowMs_ = ms;
+      slowSite_ = site;
+    }
+    site_ = outer;
+  }
+
+  /* The record left by the last run, if it ended in a stall reset */
+  bool hasRecord() const { return hasRecord_; }
+  const Record& record() const { return last_; }
+  void clearRecord() { hasRecord_ = false; }
+
+  uint32_t worstMs(uint8_t site) const { return worstMs_[site]; }
+  uint32_t worstGapMs() const { return worstGapMs_; }
+  uint8_t worstGapSite() const { return worstGapSite_; }
+
+  static const char* siteName(uint8_t site);
+
+  /* Worst time per call site, plus the last reset record if any */
+  void print(Print& out) const;
+
+  void tick();  // from the timer interrupt
+
+private:
+  static uint32_t checksum(const Record& r);
+
+  volatile uint32_t kickedAt_ = 0;
+  volatile uint8_t site_ = STALL_SITE_LOOP;
+  uint8_t slowSite_ = STALL_SITE_LOOP;
+  uint32_t slowMs_ = 0;
+  bool started_ = false;
+  uint32_t rebootMs_ = 0;
+  uint32_t worstMs_[STALL_SITE_COUNT] = {};
+  uint32_t worstGapMs_ = 0;
+  uint8_t worstGapSite_ = STALL_SITE_LOOP;
+  bool hasRecord_ = false;
+  Record last_ = {};
+};
+
+extern StallWatch stallWatch;
+
+// Marks the enclosing scope as a call that may block the loop
+class BlockingRegion {
+public:
+  explicit BlockingRegion(uint8_t site)
+    : site_(site), outer_(stallWatch.enter(site)), start_(millis()) {}
+  ~BlockingRegion() { stallWatch.leave(site_, outer_, millis() - start_); }
+
+private:
+  uint8_t site_;
+  uint8_t outer_;
+  uint32_t start_;
+};
+
+#endif
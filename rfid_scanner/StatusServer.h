@@ -0,0 +1,277 @@
+#ifndef STATUS_SERVER_H
+#define STATUS_SERVER_H
+
+#include <Arduino.h>
+#include <WiFiS3.h>
+#include "Log.h"
+#include "LatencyStats.h"
+#include "StallWatch.h"
+
+/* =====================================================================
+ *  StatusServer.h — tiny local HTTP server for on-site diagnostics
+ *
+ *    GET /metrics   Prometheus text exposition format
+ *    GET /status    JSON
+ *
+ *  One client at a time, advanced a step per poll() so a scrape never
+ *  holds up a scan:
+ *
+ *    IDLE      check for a client, at most every STATUS_ACCEPT_MS
+ *    READING   read the request line, drain the headers
+ *    WRITING   render the page once into a fixed buffer, then send it
+ *              STATUS_WRITE_CHUNK bytes per poll
+ *
+ *  Pages are rendered by the caller's functions into a FixedPrint, so
+ *  the body is built from the same Print calls as the serial stats.
+ *  The server itself allocates nothing; a renderer may (the sketch's
+ *  /status goes through its JsonDocument, which lives on the heap).
+ *  Responses end with Connection: close.
+ *
+ *  Scrape cost is kept: render time, accept-to-close time, and the
+ *  worst single poll(), which is what a scan could be delayed by.
+ * ===================================================================== */
+
+#define STATUS_BUFFER_SIZE 2560
+#define STATUS_ACCEPT_MS 100          // each check is a round trip to the WiFi module
+#define STATUS_WRITE_CHUNK 256
+#define STATUS_CLIENT_TIMEOUT_MS 2000
+
+// Print into a fixed buffer.  Output past the end is dropped and sets overflow().
+class FixedPrint : public Print {
+public:
+  FixedPrint(char* buf, size_t size) : buf_(buf), size_(size) {}
+
+  size_t write(uint8_t c) override {
+    if (len_ >= size_) {
+      overflow_ = true;
+      return 0;
+    }
+    buf_[len_++] = c;
+    return 1;
+  }
+
+  size_t write(const uint8_t* p, size_t n) override {
+    size_t room = size_ - len_;
+    if (n > room) {
+      overflow_ = true;
+      n = room;
+    }
+    memcpy(buf_ + len_, p, n);
+    len_ += n;
+    return n;
+  }
+
+  size_t length() const { return len_; }
+  bool overflow() const { return overflow_; }
+
+private:
+  char* buf_;
+  size_t size_;
+  size_t len_ = 0;
+  bool overflow_ = false;
+};
+
+class StatusServer {
+public:
+  typedef void (*Renderer)(Print& out);
+
+  StatusServer(uint16_t port, Renderer metrics, Renderer status)
+    : server_(port), port_(port), metrics_(metrics), status_(status) {}
+
+  void poll() {
+    unsigned long start = micros();
+    step();
+    unsigned long us = micros() - start;
+    if (us > pollMaxUs_) pollMaxUs_ = us;
+  }
+
+  /* Render a page into the send buffer as a scrape would, and return
+     its length.  For benchmarks; does nothing mid-scrape. */
+  size_t render(Renderer page) {
+    if (phase_ != IDLE) return 0;
+    FixedPrint out(buf_, sizeof(buf_));
+    page(out);
+    return out.length();
+  }
+
+  uint32_t scrapes() const { return scrapes_.count(); }
+  const LatencyStats& scrapeStats() const { return scrapes_; }
+  const LatencyStats& renderStats() const { return renders_; }
+  unsigned long pollMaxUs() const { return pollMaxUs_; }
+
+  void printStats(Stream& out) const {
+    out.print("[Status] port=");
+    out.print(port_);
+    out.print(" listening=");
+    out.print(listening_);
+    out.print(" poll_us(max)=");
+    out.println(pollMaxUs_);
+    scrapes_.print(out, "[Status] scrapes", "ms");
+    renders_.print(out, "[Status] render", "us");
+  }
+
+private:
+  enum Phase : uint8_t { IDLE, READING, WRITING };
+
+  WiFiServer server_;
+  WiFiClient client_;
+  uint16_t port_;
+  Renderer metrics_;
+  Renderer status_;
+
+  Phase phase_ = IDLE;
+  bool listening_ = false;
+  unsigned long checkedAt_ = 0;
+  unsigned long acceptedAt_ = 0;
+
+  char request_[48];      // request line, truncated
+  size_t requestLen_ = 0;
+  bool requestLineDone_ = false;
+  size_t lineLen_ = 0;    // length of the header line being drained
+
+  char buf_[STATUS_BUFFER_SIZE];
+  size_t length_ = 0;
+  size_t sent_ = 0;
+
+  LatencyStats scrapes_;  // failures = timed out or client went away
+  LatencyStats renders_;
+  unsigned long pollMaxUs_ = 0;
+
+  void step() {
+    switch (phase_) {
+      case IDLE:
+        accept();
+        return;
+
+      case READING:
+        if (read()) {
+          respond();
+          phase_ = WRITING;
+        } else if (expired()) {
+          finish(false);
+        }
+        return;
+
+      case WRITING:
+        write();
+        return;
+    }
+  }
+
+  bool expired() const { return millis() - acceptedAt_ >= STATUS_CLIENT_TIMEOUT_MS; }
+
+  void accept() {
+    if (millis() - checkedAt_ < STATUS_ACCEPT_MS) return;
+    checkedAt_ = millis();
+
+    STALL_REGION(STALL_SITE_STATUS);
+    if (WiFi.status() != WL_CONNECTED) {
+      listening_ = false;  // the module drops the socket with the connection
+      return;
+    }
+    if (!listening_) {
+      server_.begin();
+      listening_ = true;
+      return;
+    }
+
+    client_ = server_.available();
+    if (!client_) return;
+
+    acceptedAt_ = millis();
+    requestLen_ = 0;
+    requestLineDone_ = false;
+    lineLen_ = 0;
+    phase_ = READING;
+  }
+
+  // True once the blank line ending the headers has been read
+  bool read() {
+    STALL_REGION(STALL_SITE_STATUS);
+    uint8_t chunk[64];
+    int n = client_.available() ? client_.read(chunk, sizeof(chunk)) : 0;
+    for (int i = 0; i < n; i++) {
+      char c = chunk[i];
+      if (c == '\r') continue;
+      if (c == '\n') {
+        if (lineLen_ == 0 && requestLineDone_) return true;
+        requestLineDone_ = true;
+        lineLen_ = 0;
+        continue;
+      }
+      lineLen_++;
+      if (!requestLineDone_ && requestLen_ < sizeof(request_) - 1) {
+        request_[requestLen_++] = c;
+      }
+    }
+    return false;
+  }
+
+  void respond() {
+    request_[requestLen_] = '\0';
+    Renderer render = nullptr;
+    const char* type = nullptr;
+    if (matches("/metrics")) {
+      render = metrics_;
+      type = "text/plain; version=0.0.4";
+    } else if (matches("/status")) {
+      render = status_;
+      type = "application/json";
+    }
+
+    unsigned long start = micros();
+    FixedPrint out(buf_, sizeof(buf_));
+    if (render) {
+      header(out, "200 OK", type);
+      render(out);
+    } else {
+      header(out, "404 Not Found", "text/plain");
+      out.println("try /metrics or /status");
+    }
+    renders_.add(micros() - start, !out.overflow());
+    length_ = out.length();
+    sent_ = 0;
+
+    if (out.overflow()) {
+      LOG_WARN("[Status] %s is larger than STATUS_BUFFER_SIZE", request_);
+      FixedPrint error(buf_, sizeof(buf_));
+      header(error, "500 Internal Server Error", "text/plain");
+      length_ = error.length();
+    }
+  }
+
+  bool matches(const char* path) const {
+    size_t n = strlen(path);
+    return strncmp(request_, "GET ", 4) == 0 && strncmp(request_ + 4, path, n) == 0 &&
+           (request_[4 + n] == ' ' || request_[4 + n] == '?' || request_[4 + n] == '\0');
+  }
+
+  static void header(Print& out, const char* status, const char* type) {
+    out.print("HTTP/1.1 ");
+    out.println(status);
+    out.print("Content-Type: ");
+    out.println(type);
+    out.println("Connection: close");
+    out.println();
+  }
+
+  void write() {
+    if (!client_.connected() || expired()) {
+      finish(false);
+      return;
+    }
+
+    STALL_REGION(STALL_SITE_STATUS);
+    size_t n = min((size_t)STATUS_WRITE_CHUNK, length_ - sent_);
+    sent_ += client_.write((const uint8_t*)buf_ + sent_, n);
+    if (sent_ >= length_) finish(true);
+  }
+
+  void finish(bool ok) {
+    client_.stop();
+    scrapes_.add(millis() - acceptedAt_, ok);
+    phase_ = IDLE;
+  }
+};
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef TAG_FILTER_H
+#define TAG_FILTER_H
+
+#include <Arduino.h>
+
+/* =====================================================================
+ *  TagFilter.h — local accept/reject decision for scanned tags
+ *
+ *  Holds the server's set of rejected tags (invalid or already redeemed)
+ *  so read_next_rfid() can decide without a network round trip.  The set
+ *  is a sorted table of 32-bit UID fingerprints (FNV-1a), searched by
+ *  bisection:
+ *    • deny() and allow() add and remove single tags, so a delta sync
+ *      can take a tag back off the list
+ *    • a hit is final: with n tags on the list a good tag shares a
+ *      fingerprint with one of them with chance n / 2^32, about 1 in
+ *      8 million scans at the full TAG_FILTER_MAX
+ *
+ *  A tag denied once the table is full can't be held; it's counted in
+ *  overflows() and accepted, so the server still sees the scan.
+ * ===================================================================== */
+
+#define TAG_FILTER_MAX 512    // rejected tags held, 4 bytes each
+#define TAG_UID_MAX 10        // ISO 14443A UIDs are 4, 7 or 10 bytes
+
+class TagFilter {
+public:
+  struct Uid {
+    uint8_t size;
+    uint8_t bytes[TAG_UID_MAX];
+  };
+
+  bool rejects(const uint8_t* uid, uint8_t size) const {
+    uint16_t i;
+    return find(fingerprint(uid, size), i);
+  }
+
+  /* Start of a full sync: forget everything. */
+  void reset() {
+    count_ = 0;
+    overflows_ = 0;
+  }
+
+  /* Tag is now rejected. */
+  void deny(const uint8_t* uid, uint8_t size) {
+    uint32_t f = fingerprint(uid, size);
+    uint16_t i;
+    if (find(f, i)) return;
+    if (count_ >= TAG_FILTER_MAX) {
+      overflows_++;
+      return;
+    }
+    memmove(&table_[i + 1], &table_[i], (count_ - i) * sizeof(table_[0]));
+    table_[i] = f;
+    count_++;
+  }
+
+  /* Tag is accepted again. */
+  void allow(const uint8_t* uid, uint8_t size) {
+    uint16_t i;
+    if (!find(fingerprint(uid, size), i)) return;
+    count_--;
+    memmove(&table_[i], &table_[i + 1], (count_ - i) * sizeof(table_[0]));
+  }
+
+  size_t footprint() const { return sizeof(*this); }
+  uint16_t count() const { return count_; }
+  uint32_t overflows() const { return overflows_; }
+
+  /* Parse a hex UID, as sent by the server.  Returns false if malformed. */
+  static bool parseHex(const char* hex, Uid& out) {
+    size_t len = strlen(hex);
+    if (len == 0 || len % 2 != 0 || len / 2 > TAG_UID_MAX) return false;
+
+    out.size = len / 2;
+    for (uint8_t i = 0; i < out.size; i++) {
+      int hi = hexValue(hex[2 * i]);
+      int lo = hexValue(hex[2 * i + 1]);
+      if (hi < 0 || lo < 0) return false;
+      out.bytes[i] = (hi << 4) | lo;
+    }
+    return true;
+  }
+
+private:
+  uint32_t table_[TAG_FILTER_MAX];  // sorted
+  uint16_t count_ = 0;
+  uint32_t overflows_ = 0;          // denied tags that didn't fit
+
+  static uint32_t fingerprint(const uint8_t* uid, uint8_t size) {
+    uint32_t h = 2166136261UL;  // FNV-1a
+    for (uint8_t i = 0; i < size; i++) {
+      h = (h ^ uid[i]) * 16777619UL;
+    }
+    return h;
+  }
+
+  // True if f is held, at index i; otherwise i is where it would go
+  bool find(uint32_t f, uint16_t& i) const {
+    uint16_t lo = 0, hi = count_;
+    while (lo < hi) {
+      uint16_t mid = (lo + hi) / 2;
+      if (table_[mid] < f) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    i = lo;
+    return lo < count_ && table_[lo] == f;
+  }
+
+  static int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  }
+};
+
+#endif
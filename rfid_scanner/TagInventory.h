@@ -0,0 +1,147 @@
+#ifndef TAG_INVENTORY_H
+#define TAG_INVENTORY_H
+
+#include <Arduino.h>
+#include <MFRC522.h>
+#include "LatencyStats.h"
+#include "TagPayload.h"
+
+/* =====================================================================
+ *  TagInventory.h — read every tag in the field in one pass
+ *
+ *  PICC_IsNewCardPresent() + PICC_ReadCardSerial() selects one tag per
+ *  call.  scan() repeats the ISO 14443A request / anticollision / select
+ *  sequence, halting each tag once its UID is read.  A halted tag no
+ *  longer answers REQA, so the next round selects another one, until no
+ *  tag answers or maxTags are read.
+ *
+ *  With several tags in the field a REQA is often lost to a timeout or
+ *  a CRC error, so a round that gets no answer is tried
+ *  TAG_INVENTORY_REQA_RETRIES more times before the pass ends.  A tag
+ *  that comes back with a UID already read didn't take its HLTA; it is
+ *  halted again and the pass ends, rather than filling the list with
+ *  one tag.
+ *
+ *  Halted tags stay quiet until they leave the field.  scan(true) sends
+ *  WUPA instead of REQA for the first round, waking them again (used by
+ *  the benchmark, which inventories the same tags over and over).
+ *
+ *  Time per inventory is kept per tag count, so the cost of each extra
+ *  tag in a group can be read off the health check.  For each scan,
+ *  partials() counts tags that answered the request but couldn't be
+ *  selected (a weak or moving tag), and uidUs(i) is the time from the
+ *  request being answered to tag i's UID.  retries() and duplicates()
+ *  count the lost requests and repeated UIDs over all scans.
+ *
+ *  Given a TagPayloadReader, each tag's payload is read while it is
+ *  selected, before it is halted; see payload(i).
+ * ===================================================================== */
+
+#define TAG_INVENTORY_REQA_RETRIES 1
+
+template <uint8_t MAX_TAGS>
+class TagInventory {
+public:
+  explicit TagInventory(MFRC522& reader, TagPayloadReader* payloads = nullptr)
+    : reader_(reader), payloads_(payloads) {}
+
+  /* Returns how many tags were read; see tag(i) */
+  uint8_t scan(bool wake = false) {
+    unsigned long start = micros();
+    count_ = 0;
+    partials_ = 0;
+
+    // Same reset PICC_IsNewCardPresent() does, in case a previous
+    // exchange changed the baud rate
+    reader_.PCD_WriteRegister(MFRC522::TxModeReg, 0x00);
+    reader_.PCD_WriteRegister(MFRC522::RxModeReg, 0x00);
+    reader_.PCD_WriteRegister(MFRC522::ModWidthReg, 0x26);
+
+    uint8_t misses = 0;
+    while (count_ < MAX_TAGS) {
+      byte atqa[2];
+      byte atqaSize = sizeof(atqa);
+      MFRC522::StatusCode status = wake && count_ == 0
+        ? reader_.PICC_WakeupA(atqa, &atqaSize)
+        : reader_.PICC_RequestA(atqa, &atqaSize);
+      // Tags of different types answering together collide in the ATQA
+      if (status != MFRC522::STATUS_OK && status != MFRC522::STATUS_COLLISION) {
+        if (misses++ >= TAG_INVENTORY_REQA_RETRIES) break;
+        retries_++;
+        continue;
+      }
+      misses = 0;
+
+      unsigned long detectedAt = micros();
+      if (reader_.PICC_Select(&tags_[count_]) != MFRC522::STATUS_OK) {
+        partials_++;
+        break;
+      }
+      if (held(tags_[count_])) {
+        duplicates_++;
+        reader_.PICC_HaltA();
+        break;
+      }
+      uidUs_[count_] = micros() - detectedAt;
+      payload_[count_].clear();
+      if (payloads_) {
+        payloads_->read(tags_[count_], payload_[count_], micros() - start);
+      }
+      reader_.PICC_HaltA();
+      if (payloads_) payloads_->finish();
+      count_++;
+    }
+
+    if (count_ > 0) {
+      stats_[count_ - 1].add(micros() - start);
+    }
+    return count_;
+  }
+
+  uint8_t count() const { return count_; }
+  const MFRC522::Uid& tag(uint8_t i) const { return tags_[i]; }
+  unsigned long uidUs(uint8_t i) const { return uidUs_[i]; }
+  const TagPayload& payload(uint8_t i) const { return payload_[i]; }
+  uint8_t partials() const { return partials_; }
+  uint32_t retries() const { return retries_; }
+  uint32_t duplicates() const { return duplicates_; }
+
+  /* Time to inventory n tags (1..MAX_TAGS), in microseconds */
+  const LatencyStats& stats(uint8_t n) const { return stats_[n - 1]; }
+
+  void printStats(Stream& out) const {
+    char label[24];
+    for (uint8_t n = 1; n <= MAX_TAGS; n++) {
+      const LatencyStats& s = stats_[n - 1];
+      if (s.count() == 0) continue;
+      snprintf(label, sizeof(label), "[Inventory] tags=%u", n);
+      s.print(out, label, "us");
+    }
+    out.print("[Inventory] reqa_retries=");
+    out.print(retries_);
+    out.print(" duplicates=");
+    out.println(duplicates_);
+  }
+
+private:
+  MFRC522& reader_;
+  TagPayloadReader* payloads_;
+  MFRC522::Uid tags_[MAX_TAGS];
+  TagPayload payload_[MAX_TAGS];
+  unsigned long uidUs_[MAX_TAGS];
+  uint8_t count_ = 0;
+  uint8_t partials_ = 0;
+  uint32_t retries_ = 0;     // requests repeated after no answer
+  uint32_t duplicates_ = 0;  // selected a tag whose UID was already read
+  LatencyStats stats_[MAX_TAGS];
+
+  // The last selected tag, tags_[count_], was already read this pass
+  bool held(const MFRC522::Uid& uid) const {
+    for (uint8_t i = 0; i < count_; i++) {
+      if (tags_[i].size == uid.size && memcmp(tags_[i].uidByte, uid.uidByte, uid.size) == 0) return true;
+    }
+    return false;
+  }
+};
+
+#endif
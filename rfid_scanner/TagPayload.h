@@ -0,0 +1,209 @@
+#ifndef TAG_PAYLOAD_H
+#define TAG_PAYLOAD_H
+
+#include <Arduino.h>
+#include <MFRC522.h>
+#include "LatencyStats.h"
+
+/* =====================================================================
+ *  TagPayload.h — ticket data carried in the tag's user memory
+ *
+ *  The first TAG_PAYLOAD_BYTES of user memory hold a record:
+ *
+ *    byte 0        TAG_PAYLOAD_MAGIC
+ *    byte 1        length n, at most TAG_PAYLOAD_BYTES - 2
+ *    bytes 2..n+1  data, opaque to the scanner (ticket fields and their
+ *                  signature, checked by the server)
+ *
+ *  Read while the tag is selected, between PICC_Select() and
+ *  PICC_HaltA(), in as few exchanges as the tag allows:
+ *
+ *    NTAG21x         one FAST_READ (0x3A) of pages 4..11
+ *    MIFARE Classic  one authentication of sector 1 (key A), then
+ *                    MIFARE_Read of blocks 4 and 5 under it
+ *
+ *  Other tag types have no payload.  The record is parsed in place:
+ *  TagPayload::data points into the bytes as read.
+ *
+ *  A failed authentication (e.g. a tag with another key) or a NAKed
+ *  FAST_READ drops the tag back to IDLE, where it ignores HLTA and
+ *  would answer the inventory's next REQA.  read() then selects it
+ *  again by its UID (REQA, which leaves halted tags alone, then SELECT)
+ *  so the caller's HLTA takes.
+ *
+ *  read() is skipped once the tap has used budgetUs, so a group of
+ *  tags can't run past the tap-time budget; those tags are still read
+ *  by UID.  Read time is kept per tag type.
+ * ===================================================================== */
+
+#define TAG_PAYLOAD_BYTES 32
+#define TAG_PAYLOAD_MAGIC 0xA7
+#define TAG_PAYLOAD_NTAG_PAGE 4      // first user memory page
+#define TAG_PAYLOAD_CLASSIC_BLOCK 4  // first block of sector 1
+
+struct TagPayload {
+  uint8_t raw[TAG_PAYLOAD_BYTES];  // user memory as read
+  const uint8_t* data = nullptr;   // into raw; nullptr if there's no payload
+  uint8_t length = 0;
+
+  bool valid() const { return data != nullptr; }
+  void clear() {
+    data = nullptr;
+    length = 0;
+  }
+};
+
+class TagPayloadReader {
+public:
+  TagPayloadReader(MFRC522& reader, const byte key[6], unsigned long budgetUs)
+    : reader_(reader), budgetUs_(budgetUs) {
+    memcpy(key_.keyByte, key, sizeof(key_.keyByte));
+  }
+
+  /* Read the selected tag's payload.  elapsedUs is how much of the tap
+     budget has been used.  False if the tag has no valid payload. */
+  bool read(MFRC522::Uid& uid, TagPayload& out, unsigned long elapsedUs) {
+    out.clear();
+    Kind kind = kindOf(uid.sak);
+    if (kind == OTHER) return false;
+    if (elapsedUs >= budgetUs_) {
+      overBudget_++;
+      return false;
+    }
+
+    unsigned long start = micros();
+    bool ok = kind == NTAG ? fastRead(out) : classicRead(uid, out);
+    reads_[kind].add(micros() - start, ok);
+    if (!ok) {
+      reselect(uid);
+      return false;
+    }
+    if (!parse(out)) {
+      blank_++;
+      return false;
+    }
+    return true;
+  }
+
+  /* Call after PICC_HaltA(), to end a MIFARE Classic session. */
+  void finish() {
+    if (authenticated_) {
+      reader_.PCD_StopCrypto1();
+      authenticated_ = false;
+    }
+  }
+
+  /* Wake, select, read and halt one tag held to the reader.  For the
+     benchmark, which reads the same tag over and over. */
+  bool readAgain(MFRC522::Uid& uid, TagPayload& out) {
+    byte atqa[2];
+    byte atqaSize = sizeof(atqa);
+    if (reader_.PICC_WakeupA(atqa, &atqaSize) != MFRC522::STATUS_OK) return false;
+    if (reader_.PICC_Select(&uid) != MFRC522::STATUS_OK) return false;
+    bool ok = read(uid, out, 0);
+    reader_.PICC_HaltA();
+    finish();
+    return ok;
+  }
+
+  static const char* typeName(byte sak) {
+    switch (kindOf(sak)) {
+      case NTAG: return "ntag";
+      case CLASSIC: return "classic";
+      default: return "other";
+    }
+  }
+
+  void printStats(Stream& out) const {
+    reads_[NTAG].print(out, "[Payload] ntag fast_read", "us");
+    reads_[CLASSIC].print(out, "[Payload] classic auth_read", "us");
+    out.print("[Payload] blank=");
+    out.print(blank_);
+    out.print(" over_budget=");
+    out.print(overBudget_);
+    out.print(" reselects=");
+    out.print(reselects_);
+    out.print(" lost=");
+    out.println(lost_);
+  }
+
+private:
+  enum Kind : uint8_t { NTAG, CLASSIC, OTHER };
+
+  MFRC522& reader_;
+  MFRC522::MIFARE_Key key_;
+  unsigned long budgetUs_;
+  bool authenticated_ = false;
+
+  LatencyStats reads_[2];   // per Kind; failures = the tag didn't answer
+  uint32_t blank_ = 0;      // read, but no payload record
+  uint32_t overBudget_ = 0; // skipped, the tap had used its budget
+  uint32_t reselects_ = 0;  // tags selected again after a failed read
+  uint32_t lost_ = 0;       // ...that didn't answer; the inventory drops its repeat
+
+  static Kind kindOf(byte sak) {
+    switch (MFRC522::PICC_GetType(sak)) {
+      case MFRC522::PICC_TYPE_MIFARE_UL:
+        return NTAG;
+      case MFRC522::PICC_TYPE_MIFARE_MINI:
+      case MFRC522::PICC_TYPE_MIFARE_1K:
+      case MFRC522::PICC_TYPE_MIFARE_4K:
+        return CLASSIC;
+      default:
+        return OTHER;
+    }
+  }
+
+  // FAST_READ returns every page in one frame.  The MFRC522 FIFO holds
+  // 64 bytes, so a single read is limited to 15 pages.
+  bool fastRead(TagPayload& out) {
+    byte cmd[5] = { 0x3A, TAG_PAYLOAD_NTAG_PAGE, TAG_PAYLOAD_NTAG_PAGE + TAG_PAYLOAD_BYTES / 4 - 1 };
+    if (reader_.PCD_CalculateCRC(cmd, 3, &cmd[3]) != MFRC522::STATUS_OK) return false;
+
+    byte buf[TAG_PAYLOAD_BYTES + 2];  // + CRC
+    byte size = sizeof(buf);
+    if (reader_.PCD_TransceiveData(cmd, sizeof(cmd), buf, &size, nullptr, 0, true) != MFRC522::STATUS_OK) return false;
+    if (size < TAG_PAYLOAD_BYTES) return false;
+    memcpy(out.raw, buf, TAG_PAYLOAD_BYTES);
+    return true;
+  }
+
+  bool classicRead(MFRC522::Uid& uid, TagPayload& out) {
+    if (reader_.PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_A, TAG_PAYLOAD_CLASSIC_BLOCK, &key_, &uid) != MFRC522::STATUS_OK) {
+      return false;
+    }
+    authenticated_ = true;
+
+    // Both blocks are in the sector just authenticated
+    for (byte i = 0; i < TAG_PAYLOAD_BYTES / 16; i++) {
+      byte buf[18];  // 16 + CRC
+      byte size = sizeof(buf);
+      if (reader_.MIFARE_Read(TAG_PAYLOAD_CLASSIC_BLOCK + i, buf, &size) != MFRC522::STATUS_OK) return false;
+      memcpy(out.raw + 16 * i, buf, 16);
+    }
+    return true;
+  }
+
+  void reselect(MFRC522::Uid& uid) {
+    reader_.PCD_StopCrypto1();  // harmless if authentication never got that far
+    authenticated_ = false;
+    reselects_++;
+
+    byte atqa[2];
+    byte atqaSize = sizeof(atqa);
+    MFRC522::StatusCode status = reader_.PICC_RequestA(atqa, &atqaSize);
+    if ((status != MFRC522::STATUS_OK && status != MFRC522::STATUS_COLLISION) ||
+        reader_.PICC_Select(&uid, uid.size * 8) != MFRC522::STATUS_OK) {
+      lost_++;
+    }
+  }
+
+  static bool parse(TagPayload& p) {
+    if (p.raw[0] != TAG_PAYLOAD_MAGIC || p.raw[1] == 0 || p.raw[1] > TAG_PAYLOAD_BYTES - 2) return false;
+    p.data = p.raw + 2;
+    p.length = p.raw[1];
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,34 @@
+#include "Trace.h"
+
+Tracer tracer;
+
+static void printHex(Print& out, uint32_t v, uint8_t digits) {
+  static const char hex[] = "0123456789abcdef";
+  for (int8_t i = digits - 1; i >= 0; i--) {
+    out.print(hex[(v >> (i * 4)) & 0xF]);
+  }
+}
+
+void Tracer::dump(Print& out) const {
+  uint32_t n = head_ < TRACE_RING_SIZE ? head_ : TRACE_RING_SIZE;
+
+  out.print("TRACE v1 records=");
+  out.print(n);
+  out.print(" dropped=");
+  out.print(head_ - n);
+  out.print(" build=");
+  out.print(__DATE__);
+  out.print(" ");
+  out.println(__TIME__);
+
+  for (uint32_t i = head_ - n; i != head_; i++) {
+    const Record& r = ring_[i & (TRACE_RING_SIZE - 1)];
+    printHex(out, r.at, 8);
+    printHex(out, r.kind, 2);
+    printHex(out, r.a, 2);
+    printHex(out, r.b, 4);
+    printHex(out, r.c, 8);
+    out.println();
+  }
+  out.println("TRACE end");
+}
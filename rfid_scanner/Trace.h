@@ -0,0 +1,102 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <Arduino.h>
+
+/* =====================================================================
+ *  Trace.h — compact timeline recorder for field timing problems
+ *
+ *    TRACE(TRACE_CARD_READ, uid.size, 0, firstBytes);
+ *
+ *  Each call stores a 12-byte record in a RAM ring (oldest overwritten).
+ *  Send 't' on the serial monitor to dump the ring.  Dump format, one
+ *  record per line so it survives copy/paste from a terminal:
+ *
+ *    TRACE v1 records=<n> dropped=<overwritten> build=<date time>
+ *    <t_us hex8><kind hex2><a hex2><b hex4><c hex8>
+ *    ...
+ *    TRACE end
+ *
+ *  Fields of each record kind:
+ *    kind               a               b               c
+ *    TRACE_EVENT        event id        -               queue latency (us)
+ *    TRACE_STATE        state (enter)   -               -
+ *    TRACE_CARD_READ    UID size        index in tap    first 4 UID bytes
+ *    TRACE_CARD_REJECT  UID size        index in tap    first 4 UID bytes
+ *    TRACE_RUN          -               -               -
+ *    TRACE_UPDATE       -               -               duration (us), slow ones only
+ *    TRACE_DONE         -               -               run to callback (ms)
+ *    TRACE_CANCEL       0 = cancel()    -               -
+ *                       1 = stopped     idle (0 = gave up)  cancel to idle (ms)
+ *    TRACE_PIN          pin             level           -
+ *    TRACE_NET          TraceNetOp      ok / status     duration (ms)
+ *    TRACE_WIFI         connected       -               -
+ * ===================================================================== */
+
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1
+#endif
+
+#define TRACE_RING_SIZE 256      // records, 12 bytes each; must be a power of 2
+#define TRACE_SLOW_UPDATE_US 1000
+
+enum TraceKind : uint8_t {
+  TRACE_EVENT = 1,
+  TRACE_STATE,
+  TRACE_CARD_READ,
+  TRACE_CARD_REJECT,
+  TRACE_RUN,
+  TRACE_UPDATE,
+  TRACE_DONE,
+  TRACE_CANCEL,
+  TRACE_PIN,
+  TRACE_NET,
+  TRACE_WIFI,
+};
+
+enum TraceNetOp : uint8_t {
+  TRACE_NET_TRACK = 1,
+  TRACE_NET_HEALTH,
+  TRACE_NET_DNS,
+  TRACE_NET_TAG_SYNC,
+};
+
+#if TRACE_ENABLED
+#define TRACE(kind, a, b, c) tracer.record((kind), (a), (b), (c))
+#else
+#define TRACE(kind, a, b, c) do {} while (0)
+#endif
+
+class Tracer {
+public:
+  struct __attribute__((__packed__)) Record {
+    uint32_t at;  // micros()
+    uint8_t kind;
+    uint8_t a;
+    uint16_t b;
+    uint32_t c;
+  };
+
+  void record(uint8_t kind, uint8_t a, uint16_t b, uint32_t c) {
+    Record& r = ring_[head_ & (TRACE_RING_SIZE - 1)];
+    r.at = micros();
+    r.kind = kind;
+    r.a = a;
+    r.b = b;
+    r.c = c;
+    head_++;
+  }
+
+  /* Write the ring, oldest first, in the format above. */
+  void dump(Print& out) const;
+
+  uint32_t count() const { return head_; }
+
+private:
+  Record ring_[TRACE_RING_SIZE];
+  uint32_t head_ = 0;
+};
+
+extern Tracer tracer;
+
+#endif
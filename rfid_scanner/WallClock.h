@@ -0,0 +1,94 @@
+#ifndef WALL_CLOCK_H
+#define WALL_CLOCK_H
+
+#include <Arduino.h>
+#include <WiFiS3.h>
+#include <RTC.h>
+#include <time.h>
+#include "Log.h"
+#include "StallWatch.h"
+
+/* =====================================================================
+ *  WallClock.h — UTC time for stamping scans
+ *
+ *  sync() asks the WiFi modem for SNTP time and sets the R4's RTC,
+ *  which keeps time between syncs.  poll() resyncs every intervalMs
+ *  while WiFi is up.  Each resync measures how far the RTC drifted
+ *  since the last one, and how long the sync took.
+ * ===================================================================== */
+
+#define WALL_CLOCK_RETRY_MS 30000  // after a failed sync
+
+class WallClock {
+public:
+  explicit WallClock(unsigned long intervalMs)
+    : intervalMs_(intervalMs) {}
+
+  void begin() {
+    RTC.begin();
+  }
+
+  void poll() {
+    if (attempted_ && millis() - attemptAt_ < (synced_ ? intervalMs_ : WALL_CLOCK_RETRY_MS)) return;
+    // Asking the WiFi module is a round trip, so only once a sync is due
+    if (WiFi.status() != WL_CONNECTED) return;
+    sync();
+  }
+
+  bool sync() {
+    STALL_REGION(STALL_SITE_CLOCK);
+    attempted_ = true;
+    attemptAt_ = millis();
+
+    unsigned long epoch = WiFi.getTime();
+    syncMs_ = millis() - attemptAt_;
+    if (epoch == 0) {
+      LOG_WARN("[Clock] SNTP sync failed after %lums", syncMs_);
+      return false;
+    }
+
+    if (synced_) {
+      driftS_ = (long)(now() - epoch);
+    }
+
+    RTCTime t((time_t)epoch);
+    RTC.setTime(t);
+    synced_ = true;
+    syncs_++;
+    LOG_INFO("[Clock] synced to %lu in %lums, drift %lds", epoch, syncMs_, driftS_);
+    return true;
+  }
+
+  bool synced() const { return synced_; }
+
+  /* Seconds since the Unix epoch, or 0 if never synced. */
+  uint32_t now() const {
+    if (!synced_) return 0;
+    RTCTime t;
+    RTC.getTime(t);
+    return t.getUnixTime();
+  }
+
+  /* ISO 8601 UTC, e.g. 2025-07-06T15:00:00Z.  out needs 21 bytes. */
+  static void format(uint32_t epoch, char* out, size_t size) {
+    time_t t = epoch;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(out, size, "%Y-%m-%dT%H:%M:%SZ", &tm);
+  }
+
+  long driftS() const { return driftS_; }          // RTC minus SNTP at the last resync
+  unsigned long syncMs() const { return syncMs_; }  // cost of the last sync
+  uint32_t syncs() const { return syncs_; }
+
+private:
+  unsigned long intervalMs_;
+  bool synced_ = false;
+  bool attempted_ = false;
+  unsigned long attemptAt_ = 0;
+  unsigned long syncMs_ = 0;
+  long driftS_ = 0;
+  uint32_t syncs_ = 0;
+};
+
+#endif
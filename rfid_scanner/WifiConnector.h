@@ -0,0 +1,118 @@
+#ifndef WIFI_CONNECTOR_H
+#define WIFI_CONNECTOR_H
+
+#include <Arduino.h>
+#include <WiFiS3.h>
+#include "WifiCredentials.h"
+#include "Log.h"
+#include "Trace.h"
+#include "StallWatch.h"
+
+/* =====================================================================
+ *  WifiConnector.h — non-blocking WiFi association
+ *
+ *  Tries each credential in order, retrying with exponential backoff,
+ *  but as a small state machine advanced by poll() from loop(), so the
+ *  scanner keeps reading tags while the radio associates.
+ * ===================================================================== */
+
+#define WIFI_BEGIN_TIMEOUT_MS 0      // don't let WiFi.begin() wait for association
+#define WIFI_ASSOCIATE_MS 5000       // time to wait for WL_CONNECTED per attempt
+#define WIFI_DHCP_MS 2000            // time to wait for an IP after associating
+#define WIFI_RETRIES 5               // attempts per credential
+
+class WifiConnector {
+public:
+  WifiConnector(const WifiCredential* credentials, int count)
+    : credentials_(credentials), count_(count) {}
+
+  /* Start connecting, unless already in progress. */
+  void start() {
+    if (phase_ != IDLE) return;
+
+    WiFi.setTimeout(WIFI_BEGIN_TIMEOUT_MS);
+    cred_ = 0;
+    retry_ = 0;
+    delayMs_ = 20;
+    beginAttempt();
+  }
+
+  bool connecting() const { return phase_ != IDLE; }
+
+  void poll() {
+    unsigned long now = millis();
+
+    switch (phase_) {
+      case IDLE:
+        return;
+
+      case ASSOCIATING:
+        if (WiFi.status() == WL_CONNECTED) {
+          phase_ = WAITING_FOR_IP;
+          since_ = now;
+        } else if (now - since_ >= WIFI_ASSOCIATE_MS) {
+          LOG_WARN("[WiFi] failed to connect, trying again in %lums", delayMs_);
+          phase_ = BACKING_OFF;
+          since_ = now;
+        }
+        return;
+
+      case WAITING_FOR_IP:
+        if (WiFi.localIP() != IPAddress(0, 0, 0, 0) || now - since_ >= WIFI_DHCP_MS) {
+          // A log record holds one string, so one line per address
+          LOG_INFO("[WiFi] connected to SSID=%s", WiFi.SSID());
+          LOG_INFO("[WiFi] IP address=%s", WiFi.localIP().toString());
+          LOG_INFO("[WiFi] gateway=%s", WiFi.gatewayIP().toString());
+          TRACE(TRACE_WIFI, 1, 0, 0);
+          phase_ = IDLE;
+        }
+        return;
+
+      case BACKING_OFF:
+        if (now - since_ < delayMs_) return;
+
+        delayMs_ *= 2;  // Exponential backoff
+        if (++retry_ >= WIFI_RETRIES) {
+          retry_ = 0;
+          delayMs_ = 20;
+          if (++cred_ >= count_) {
+            LOG_ERROR("[WiFi] could not connect to any known networks");
+            phase_ = IDLE;
+            return;
+          }
+        }
+        beginAttempt();
+        return;
+    }
+  }
+
+private:
+  enum Phase { IDLE, ASSOCIATING, WAITING_FOR_IP, BACKING_OFF };
+
+  const WifiCredential* credentials_;
+  int count_;
+
+  Phase phase_ = IDLE;
+  int cred_ = 0;
+  int retry_ = 0;
+  unsigned long delayMs_ = 20;
+  unsigned long since_ = 0;
+
+  void beginAttempt() {
+    STALL_REGION(STALL_SITE_WIFI);
+    const WifiCredential& c = credentials_[cred_];
+    if (retry_ == 0) {
+      LOG_INFO("[WiFi] attempting to connect to SSID=%s", c.ssid);
+    }
+
+    if (c.password == nullptr || c.password[0] == '\0') {
+      WiFi.begin(c.ssid);
+    } else {
+      WiFi.begin(c.ssid, c.password);
+    }
+    phase_ = ASSOCIATING;
+    since_ = millis();
+  }
+};
+
+#endif
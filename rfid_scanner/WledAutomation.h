@@ -3,13 +3,14 @@
 
 #include "Automation.h"
 #include <SoftwareSerial.h>
-#include <ArduinoJson.h> // External: https://github.com/bblanchon/ArduinoJson v7.3.0+
+#include "WledLink.h"
 
 // UART-to-WLED (software)
 #define TX_PIN 5    // UNO ➜ WLED RX
 #define RX_PIN 4    // UNO ⇐ WLED TX
 #define WLED_BAUD 115200
 #define RUN_TIME_MS 10000 // How long to keep the lights on for
+#define STARTUP_CHECK_MS 5000 // How long to show the start-up check
 
 constexpr uint16_t WLED_NUM_PS = 4; // Number of presets, including setup() preset
 
@@ -28,42 +29,59 @@ constexpr uint8_t ATLANTICA_ID = 51;
 class WledAutomation : public Automation {
 public:
   WledAutomation() 
-    : wledSerial(RX_PIN, TX_PIN) {};
+    : wled(serialLink()), useSerial(true) {};
+
+  // Drive another output instead of the serial link, e.g. a WledUdpLink
+  // to fire several controllers together.  The serial port is then never
+  // set up, so its pins stay free.
+  explicit WledAutomation(WledOutput& output)
+    : wled(output), useSerial(false) {};
 
   void setup() override {
     Serial.println("Setting up WLED automation");
 
-    wledSerial.begin(WLED_BAUD); // software UART to WLED
-    delay(200);
+    if (useSerial) {
+      serialPort().begin(WLED_BAUD); // software UART to WLED
+    }
 
+    // Flash the start-up check; update() turns it off after STARTUP_CHECK_MS
     turnOnStartUpCheck();
-    delay(5000);
-    turnOff();
+    startupCheckAt = millis();
+    startupCheck = true;
+  }
+
+  bool ready() const override {
+    return !startupCheck;
   }
 
   void run(DoneCb cb) override {
     uint16_t preset = (num % WLED_NUM_PS) + 1;
-    Serial.print("[Action] turning on preset ");
-    Serial.println(preset);
+    LOG_INFO("[Action] turning on preset %u", preset);
     turnOnPreset(preset);
     num += 1;
     
     startAt = millis();
+    startupCheck = false;  // preset replaces the start-up check
     doneCb_ = cb;
     active_ = true;
   }
 
   void update() override {
+    wled.poll();
+
+    if (startupCheck && millis() - startupCheckAt >= STARTUP_CHECK_MS) {
+      turnOff();
+      startupCheck = false;
+    }
+
     if (!active_) return;
 
     if (millis() - startAt < RUN_TIME_MS) {
       return;
     }
 
-    Serial.println("[Action] hit time limit, turning off LEDs");
-    wledSerial.println(4);
-    wledSerial.println("{\"on\":false}");
-    // turnOff();
+    LOG_INFO("[Action] hit time limit, turning off LEDs");
+    turnOff();
 
     active_ = false;
     if (doneCb_) {
@@ -76,93 +94,105 @@ public:
   void cancel() override {
     if (!active_) return;
 
+    LOG_INFO("[Cancel] turning off LEDs");
+    turnOff();
+    active_ = false;
     doneCb_ = nullptr;
   }
 
+  /* Idle once WLED has confirmed the last command (or given up on it) */
+  bool idle() const override { return wled.idle(); }
+
+  const char* name() const override { return "WledAutomation"; }
+
+  void printStats(Stream& out) override {
+    wled.printStats(out);
+  }
+
 private:
   DoneCb doneCb_ = nullptr;
   bool active_ = false;
-  SoftwareSerial wledSerial;
+  WledOutput& wled;
+  bool useSerial;
   unsigned long startAt;
+  unsigned long startupCheckAt;
+  bool startupCheck = false;
   bool last = LOW;
   int num = 0;
 
-// ── Tiny helper to send JSON over the software UART ────────────────
-void sendJson(const JsonDocument& doc)
-{
-  serializeJson(doc, wledSerial);
-  wledSerial.println();                     // newline terminates the frame
-}
+  // Built on first use, so only when the serial link is what's driven
+  static SoftwareSerial& serialPort() {
+    static SoftwareSerial port(RX_PIN, TX_PIN);
+    return port;
+  }
+
+  static WledLink& serialLink() {
+    static WledLink link(serialPort());
+    return link;
+  }
 
 // ── High-level LED helpers ──────────────────────────────────────────
+// Each only sends what differs from WLED's last known state
 void turnOn(uint16_t effectId)
 {
-  StaticJsonDocument<64> j;
-  j["on"] = true;
-  j["seg"].createNestedObject()["fx"] = effectId;
-  sendJson(j);
+  WledState j;
+  j.on = true;
+  j.fx = effectId;
+  wled.set(j, WledState::ON | WledState::FX);
 }
 
 void turnOnStartUpCheck()
 {
-  StaticJsonDocument<64> j;
-  j["on"] = true;
-  JsonObject seg0 = j.createNestedArray("seg").createNestedObject();
-  seg0["fx"] = BLINK_ID;
-  seg0["sx"] = 200;
-  seg0["pal"] = 0;
-  JsonArray  col0 = seg0.createNestedArray("col").createNestedArray();
-  col0.add(255);
-  col0.add(0);
-  col0.add(0);
-  sendJson(j);
+  WledState j;
+  j.on = true;
+  j.fx = BLINK_ID;
+  j.sx = 200;
+  j.pal = 0;
+  j.col[0] = 255;
+  wled.set(j, WledState::ON | WledState::SEG);
 }
 
 void turnOnWithColor(uint16_t effectId, uint8_t r, uint8_t g, uint8_t b)
 {
-  StaticJsonDocument<64> j;
-  j["on"] = true;
-  JsonObject seg0 = j.createNestedArray("seg").createNestedObject();
-  seg0["fx"] = effectId;
-  seg0["pal"] = 0;
-  JsonArray  col0 = seg0.createNestedArray("col").createNestedArray();
-  col0.add(r);
-  col0.add(g);
-  col0.add(b);
-  sendJson(j);
+  WledState j;
+  j.on = true;
+  j.fx = effectId;
+  j.pal = 0;
+  j.col[0] = r;
+  j.col[1] = g;
+  j.col[2] = b;
+  wled.set(j, WledState::ON | WledState::FX | WledState::PAL | WledState::COL);
 }
 
 void turnOff()
 {
-  StaticJsonDocument<16> j;
-  j["on"] = false;
-  sendJson(j);
+  WledState j;
+  j.on = false;
+  wled.set(j, WledState::ON);
 }
 
 void turnOnPreset(uint8_t id)
 {
-  StaticJsonDocument<64> j;
-  j["on"] = true;
-  j["ps"] = id;
-  sendJson(j);
+  WledState j;
+  j.on = true;
+  j.ps = id;
+  wled.set(j, WledState::ON | WledState::PS);
 }
 
 void changeEffect(uint16_t effectId)
 {
-  StaticJsonDocument<32> j;
-  j["seg"].createNestedObject()["fx"] = effectId;
-  sendJson(j);
+  WledState j;
+  j.fx = effectId;
+  wled.set(j, WledState::FX);
 }
 
 void changeColor(uint8_t r, uint8_t g, uint8_t b)
 {
-  StaticJsonDocument<64> j;
-  JsonObject seg0 = j.createNestedArray("seg").createNestedObject();
-  JsonArray  col0 = seg0.createNestedArray("col").createNestedArray();
-  col0.add(r);
-  col0.add(g);
-  col0.add(b);
-  sendJson(j);
+  WledState j;
+  j.col[0] = r;
+  j.col[1] = g;
+  j.col[2] = b;
+  wled.set(j, WledState::COL);
 }
 };
 
@@ -0,0 +1,354 @@
+#ifndef WLED_LINK_H
+#define WLED_LINK_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>  // External: https://github.com/bblanchon/ArduinoJson v7.3.0+
+#include "Log.h"
+
+/* =====================================================================
+ *  WledLink.h — WLED serial JSON link with a state shadow
+ *
+ *  Keeps the last known WLED state and sends only fields that change.
+ *  Every command asks for the state back ("v":true); poll() reads the
+ *  reply without blocking, confirms it, and resends a command that
+ *  isn't answered within WLED_ACK_TIMEOUT_MS.  After WLED_MAX_RETRIES
+ *  the shadow is forgotten, so the next command sends every field.
+ *
+ *  The reply is {"state":{...},"info":{...}}, often over 1 KB.  It's
+ *  scanned a byte at a time as it arrives (WledReplyScanner) for
+ *  state.on and state.ps, so nothing is buffered and the length
+ *  doesn't matter.
+ *
+ *  Applying a preset changes the segment in ways we can't see, so the
+ *  segment fields become unknown after "ps".  Re-applying a preset
+ *  restarts it, so a retry leaves "ps" out: it resends the rest and
+ *  asks for the state, and the preset is only sent again if the reply
+ *  shows it wasn't applied.
+ *
+ *  WledOutput is what WledAutomation drives, so it can use this link or
+ *  WledUdpLink (several controllers over WiFi) interchangeably.
+ * ===================================================================== */
+
+#define WLED_ACK_TIMEOUT_MS 250
+#define WLED_MAX_RETRIES 3
+
+struct WledState {
+  // Fields to apply, see set()
+  static constexpr uint8_t ON = 1, PS = 2, FX = 4, SX = 8, PAL = 16, COL = 32;
+  static constexpr uint8_t SEG = FX | SX | PAL | COL;
+
+  bool on = false;
+  uint8_t ps = 0;
+  uint16_t fx = 0;
+  uint8_t sx = 128;
+  uint8_t pal = 0;
+  uint8_t col[3] = { 0, 0, 0 };
+};
+
+// A way to send WledState changes to WLED
+class WledOutput {
+public:
+  virtual ~WledOutput() {}
+
+  /* Move WLED to want, for the given WledState fields */
+  virtual void set(const WledState& want, uint8_t fields) = 0;
+  /* Read replies and resend unanswered commands.  Call every loop. */
+  virtual void poll() = 0;
+  /* No command waiting for a reply */
+  virtual bool idle() const = 0;
+  /* Treat WLED's state as unknown, e.g. after it may have rebooted. */
+  virtual void forget() = 0;
+  virtual void printStats(Stream& out) const = 0;
+};
+
+// Picks state.on and state.ps out of a WLED JSON reply fed one byte at
+// a time.  Only tracks nesting and the key being read, so it needs a few
+// bytes however long the reply is.
+class WledReplyScanner {
+public:
+  void reset() {
+    bytes_ = 0;
+    depth_ = 0;
+    inString_ = false;
+    escaped_ = false;
+    inState_ = false;
+    capturing_ = false;
+    on = -1;
+    ps = -1;
+  }
+
+  void feed(char c) {
+    if (bytes_++ == 0) json_ = c == '{';
+    if (!json_) return;
+
+    if (inString_) {
+      if (escaped_) {
+        escaped_ = false;
+      } else if (c == '\\') {
+        escaped_ = true;
+      } else if (c == '"') {
+        inString_ = false;
+        token_[tokenLen_] = '\0';
+        return;
+      }
+      if (tokenLen_ < sizeof(token_) - 1) token_[tokenLen_++] = c;
+      return;
+    }
+
+    switch (c) {
+      case '"':
+        inString_ = true;
+        tokenLen_ = 0;
+        return;
+      case ':':  // the string just read was a key
+        if (depth_ == 1) stateKey_ = strcmp(token_, "state") == 0;
+        capturing_ = inState_ && depth_ == 2 && (strcmp(token_, "on") == 0 || strcmp(token_, "ps") == 0);
+        capturingOn_ = capturing_ && token_[0] == 'o';
+        valueLen_ = 0;
+        return;
+      case '{':
+      case '[':
+        capturing_ = false;
+        depth_++;
+        if (depth_ == 2) inState_ = c == '{' && stateKey_;
+        return;
+      case '}':
+      case ']':
+        endValue();
+        if (depth_ == 2) inState_ = false;
+        if (depth_ > 0) depth_--;
+        return;
+      case ',':
+        endValue();
+        return;
+      default:
+        if (capturing_ && c != ' ' && valueLen_ < sizeof(value_) - 1) value_[valueLen_++] = c;
+    }
+  }
+
+  /* The line was a JSON reply, not log output */
+  bool json() const { return bytes_ > 0 && json_; }
+
+  int8_t on = -1;   // state.on, or -1 if not seen
+  int16_t ps = -1;  // state.ps, or -1 if not seen (WLED also sends -1 for none)
+
+private:
+  size_t bytes_ = 0;
+  bool json_ = false;
+  uint8_t depth_ = 0;
+  bool inString_ = false;
+  bool escaped_ = false;
+  char token_[8] = "";
+  uint8_t tokenLen_ = 0;
+  bool stateKey_ = false;  // the top-level key being read is "state"
+  bool inState_ = false;
+  bool capturing_ = false;
+  bool capturingOn_ = false;
+  char value_[8] = "";
+  uint8_t valueLen_ = 0;
+
+  void endValue() {
+    if (!capturing_) return;
+    capturing_ = false;
+    value_[valueLen_] = '\0';
+    if (capturingOn_) {
+      on = strcmp(value_, "true") == 0 ? 1 : 0;
+    } else {
+      ps = atoi(value_);
+    }
+  }
+};
+
+class WledLink : public WledOutput {
+public:
+  explicit WledLink(Stream& serial)
+    : serial_(serial) {}
+
+  /* Move WLED to want, for the given fields.  Fields that already match
+     the shadow are left out; presets are always sent, since re-applying
+     one restarts it. */
+  void set(const WledState& want, uint8_t fields) override {
+    uint8_t changed = 0;
+    if ((fields & WledState::ON) && (!(known_ & WledState::ON) || shadow_.on != want.on)) changed |= WledState::ON;
+    if (fields & WledState::PS) changed |= WledState::PS;
+    if ((fields & WledState::FX) && (!(known_ & WledState::FX) || shadow_.fx != want.fx)) changed |= WledState::FX;
+    if ((fields & WledState::SX) && (!(known_ & WledState::SX) || shadow_.sx != want.sx)) changed |= WledState::SX;
+    if ((fields & WledState::PAL) && (!(known_ & WledState::PAL) || shadow_.pal != want.pal)) changed |= WledState::PAL;
+    if ((fields & WledState::COL) && (!(known_ & WledState::COL) || memcmp(shadow_.col, want.col, 3) != 0)) changed |= WledState::COL;
+
+    if (!changed) {
+      skipped_++;
+      return;
+    }
+
+    want_ = want;
+    wantFields_ = changed;
+    compose(changed);
+    transitions_++;
+    // A new command, even if the last one is still unanswered: its own
+    // retries and confirm time start now
+    attempts_ = 0;
+    firstSentAt_ = millis();
+    send();
+
+    // Optimistic; corrected by the reply, or forgotten if it never comes
+    if (changed & WledState::ON) shadow_.on = want.on;
+    if (changed & WledState::PS) {
+      shadow_.ps = want.ps;
+      known_ &= ~WledState::SEG;
+    }
+    if (changed & WledState::FX) shadow_.fx = want.fx;
+    if (changed & WledState::SX) shadow_.sx = want.sx;
+    if (changed & WledState::PAL) shadow_.pal = want.pal;
+    if (changed & WledState::COL) memcpy(shadow_.col, want.col, 3);
+    known_ |= changed & ~WledState::PS;
+    expectOn_ = shadow_.on;
+  }
+
+  void poll() override {
+    while (serial_.available()) {
+      char c = serial_.read();
+      if (c == '\n') {
+        handleReply();
+        reply_.reset();
+      } else {
+        reply_.feed(c);
+      }
+    }
+
+    if (awaiting_ && millis() - sentAt_ > WLED_ACK_TIMEOUT_MS) {
+      if (attempts_ <= WLED_MAX_RETRIES) {
+        retries_++;
+        compose(wantFields_ & ~WledState::PS);  // the reply says whether the preset took
+        send();
+      } else {
+        LOG_WARN("[WLED] no reply after %d retries", WLED_MAX_RETRIES);
+        failures_++;
+        awaiting_ = false;
+        known_ = 0;
+      }
+    }
+  }
+
+  bool idle() const override { return !awaiting_; }
+
+  void forget() override { known_ = 0; }
+
+  /* Commands sent so far, not counting retries or skipped set() calls */
+  uint32_t transitions() const { return transitions_; }
+
+  void printStats(Stream& out) const override {
+    out.print("[WLED] transitions=");
+    out.print(transitions_);
+    out.print(" skipped=");
+    out.print(skipped_);
+    out.print(" bytes_per_transition=");
+    out.print(transitions_ ? bytes_ / transitions_ : 0);
+    out.print(" confirmed=");
+    out.print(acks_);
+    out.print(" retries=");
+    out.print(retries_);
+    out.print(" failures=");
+    out.print(failures_);
+    out.print(" mismatches=");
+    out.print(mismatches_);
+    out.print(" preset_resends=");
+    out.print(presetResends_);
+    out.print(" confirm_ms(last/avg/max)=");
+    out.print(lastAckMs_);
+    out.print("/");
+    out.print(acks_ ? totalAckMs_ / acks_ : 0);
+    out.print("/");
+    out.println(maxAckMs_);
+  }
+
+private:
+  Stream& serial_;
+
+  WledState shadow_;
+  uint8_t known_ = 0;       // fields of shadow_ we believe are applied
+  bool expectOn_ = false;
+
+  WledState want_;          // last command, kept for retries
+  uint8_t wantFields_ = 0;
+  char pending_[128];       // want_ as sent, for the fields of the current attempt
+  size_t pendingLength_ = 0;
+  bool awaiting_ = false;
+  uint8_t attempts_ = 0;
+  unsigned long firstSentAt_ = 0;
+  unsigned long sentAt_ = 0;
+
+  WledReplyScanner reply_;
+
+  uint32_t transitions_ = 0;
+  uint32_t skipped_ = 0;
+  uint32_t bytes_ = 0;
+  uint32_t acks_ = 0;
+  uint32_t retries_ = 0;
+  uint32_t failures_ = 0;
+  uint32_t mismatches_ = 0;
+  uint32_t presetResends_ = 0;
+  unsigned long lastAckMs_ = 0;
+  unsigned long maxAckMs_ = 0;
+  unsigned long totalAckMs_ = 0;
+
+  // want_ as a command, for the given fields
+  void compose(uint8_t fields) {
+    JsonDocument j;
+    if (fields & WledState::ON) j["on"] = want_.on;
+    if (fields & WledState::PS) j["ps"] = want_.ps;
+    if (fields & WledState::SEG) {
+      JsonObject seg0 = j["seg"].add<JsonObject>();
+      if (fields & WledState::FX) seg0["fx"] = want_.fx;
+      if (fields & WledState::SX) seg0["sx"] = want_.sx;
+      if (fields & WledState::PAL) seg0["pal"] = want_.pal;
+      if (fields & WledState::COL) {
+        JsonArray col0 = seg0["col"].add<JsonArray>();
+        col0.add(want_.col[0]);
+        col0.add(want_.col[1]);
+        col0.add(want_.col[2]);
+      }
+    }
+    j["v"] = true;  // ask for the state back
+    pendingLength_ = serializeJson(j, pending_, sizeof(pending_));
+  }
+
+  void send() {
+    serial_.write((const uint8_t*)pending_, pendingLength_);
+    serial_.println();  // newline terminates the frame
+    bytes_ += pendingLength_ + 2;
+
+    attempts_++;
+    awaiting_ = true;
+    sentAt_ = millis();
+  }
+
+  void handleReply() {
+    if (!awaiting_ || !reply_.json()) return;
+
+    // A retry left the preset out; send it again only if it didn't take
+    if ((wantFields_ & WledState::PS) && reply_.ps >= 0 && reply_.ps != want_.ps &&
+        attempts_ <= WLED_MAX_RETRIES) {
+      presetResends_++;
+      compose(wantFields_);
+      send();
+      return;
+    }
+
+    awaiting_ = false;
+    acks_++;
+    lastAckMs_ = millis() - firstSentAt_;
+    totalAckMs_ += lastAckMs_;
+    if (lastAckMs_ > maxAckMs_) maxAckMs_ = lastAckMs_;
+
+    if (reply_.on >= 0 && (reply_.on == 1) != expectOn_) {
+      mismatches_++;
+      shadow_.on = reply_.on == 1;
+    }
+    if (reply_.ps >= 0) {
+      shadow_.ps = reply_.ps;
+    }
+  }
+};
+
+#endif
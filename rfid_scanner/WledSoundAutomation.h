@@ -8,6 +8,7 @@
 #define TX_PIN 5
 #define RX_PIN 4
 #define BAUD 9600
+#define STOP_SETTLE_MS 100  // time the controller gets to stop, if it doesn't answer DONE
 
 const int START = 0;
 const int STOP = 1;
@@ -33,7 +34,7 @@ public:
     doneCb_ = cb;
     active_ = true;
 
-    Serial.println("Sending command: START");
+    LOG_INFO("Sending command: START");
     Payload command = { START };
     myTransfer.txObj(command);
     myTransfer.sendData(sizeof(command));
@@ -42,13 +43,23 @@ public:
   }
 
   void update() override {
+    if (stopping_) {
+      if (myTransfer.available()) {
+        Payload data;
+        myTransfer.rxObj(data);
+        if (data.cmd == DONE) stopping_ = false;
+      } else if (millis() - stopAt_ >= STOP_SETTLE_MS) {
+        stopping_ = false;
+      }
+      return;
+    }
+
     if (!active_) return;
 
     if (myTransfer.available()) {
       Payload data;
       myTransfer.rxObj(data);
-      Serial.print("Cmd: ");
-      Serial.print(data.cmd);
+      LOG_DEBUG("Cmd: %d", data.cmd);
 
       if (data.cmd == DONE) {
         active_ = false;
@@ -59,7 +70,7 @@ public:
         }
       }
     } else if (millis() - lastDebug > 1000) {
-      Serial.print(myTransfer.status);
+      LOG_DEBUG("Transfer status: %d", myTransfer.status);
       lastDebug = millis();
     }
   }
@@ -67,18 +78,27 @@ public:
   void cancel() override {
     if (!active_) return;
 
-    Serial.println("Sending command: STOP");
+    LOG_INFO("Sending command: STOP");
     Payload data = { STOP };
     myTransfer.txObj(data);
     myTransfer.sendData(sizeof(data));
-    delay(100);
 
+    active_ = false;
     doneCb_ = nullptr;
+    stopping_ = true;
+    stopAt_ = millis();
   }
 
+  /* Idle once the controller answers DONE, or STOP_SETTLE_MS after STOP */
+  bool idle() const override { return !stopping_; }
+
+  const char* name() const override { return "WledSoundAutomation"; }
+
 private:
   DoneCb doneCb_ = nullptr;
   bool active_ = false;
+  bool stopping_ = false;
+  unsigned long stopAt_ = 0;
 
   SoftwareSerial cmdSerial;
   SerialTransfer myTransfer;
@@ -0,0 +1,298 @@
+#ifndef WLED_UDP_LINK_H
+#define WLED_UDP_LINK_H
+
+#include <Arduino.h>
+#include <WiFiS3.h>
+#include <WiFiUdp.h>
+#include <ArduinoJson.h>  // External: https://github.com/bblanchon/ArduinoJson v7.3.0+
+#include "Log.h"
+#include "LatencyStats.h"
+#include "WledLink.h"
+
+/* =====================================================================
+ *  WledUdpLink.h — fan WLED commands out to several controllers over WiFi
+ *
+ *    const WledTarget wleds[] = { { IPAddress(192, 168, 5, 50) },
+ *                                 { IPAddress(192, 168, 5, 51) } };
+ *    WledUdpLink wledUdp(wleds, 2);
+ *    WledAutomation automation(wledUdp);
+ *
+ *  Each command is one JSON datagram, the same JSON WledLink sends over
+ *  serial, sent to every controller back to back on WLED's UDP port
+ *  (21324, which takes JSON API packets as of WLED 0.14).
+ *
+ *  WLED doesn't answer UDP commands, but with Sync > "Send notifications
+ *  on direct change" enabled it broadcasts a sync packet (first byte 0)
+ *  whenever its state changes.  That packet, from the controller's
+ *  address and port, is taken as its ack.  Controllers that haven't
+ *  acked within WLED_UDP_ACK_TIMEOUT_MS get the command again, up to
+ *  WLED_UDP_MAX_RETRIES times.  Pass expectSync = false for controllers
+ *  that don't send notifications; commands are then fire and forget.
+ *
+ *  A command that leaves a controller's state as it was brings no
+ *  notification, so the state each controller last acked is kept.  A
+ *  controller the command doesn't change isn't waited for, and can't
+ *  count as a failure.  Presets always count as a change.
+ *
+ *  Unlike WledLink, every requested field is still sent: a datagram
+ *  costs about the same whatever its size.
+ *
+ *  Per controller the time to hand the datagram to the WiFi module and
+ *  the command-to-ack time are kept.  Across controllers, skew is the
+ *  time between the first and last ack of a command: how far apart the
+ *  strips started.
+ * ===================================================================== */
+
+#define WLED_UDP_PORT 21324
+#define WLED_UDP_MAX 8               // controllers
+#define WLED_UDP_ACK_TIMEOUT_MS 250
+#define WLED_UDP_MAX_RETRIES 2
+#define WLED_UDP_POLL_MS 5           // each check for packets is a round trip to the WiFi module
+#define WLED_UDP_BEGIN_RETRY_MS 5000 // before WiFi is up, opening the socket fails
+
+struct WledTarget {
+  IPAddress ip;
+  uint16_t port = WLED_UDP_PORT;
+};
+
+class WledUdpLink : public WledOutput {
+public:
+  WledUdpLink(const WledTarget* targets, uint8_t count, bool expectSync = true)
+    : targets_(targets), count_(min(count, (uint8_t)WLED_UDP_MAX)), expectSync_(expectSync) {}
+
+  void set(const WledState& want, uint8_t fields) override {
+    if (!begin()) {
+      dropped_++;
+      return;
+    }
+    drain();  // don't take an old notification for an ack
+
+    length_ = command(want, fields, pending_, sizeof(pending_));
+    pendingState_ = want;
+    pendingFields_ = fields;
+    commands_++;
+    sentAt_ = millis();
+    resentAt_ = sentAt_;
+    attempts_ = 1;
+    firstAckAt_ = 0;
+    lastAckAt_ = 0;
+
+    unsigned long first = micros();
+    for (uint8_t i = 0; i < count_; i++) {
+      acked_[i] = unchanged(i);  // no notification will come
+      if (acked_[i]) unchanged_++;
+      send(i);
+    }
+    spread_.add(micros() - first);
+    awaiting_ = expectSync_ && unacked() > 0;
+  }
+
+  void poll() override {
+    if (!awaiting_) return;
+    if (millis() - polledAt_ < WLED_UDP_POLL_MS) return;
+    polledAt_ = millis();
+
+    for (uint8_t n = 0; n < count_ && udp_.parsePacket() > 0; n++) {
+      handlePacket();
+    }
+
+    if (unacked() == 0) {
+      finish();
+      return;
+    }
+    if (millis() - resentAt_ < WLED_UDP_ACK_TIMEOUT_MS) return;
+
+    if (attempts_ <= WLED_UDP_MAX_RETRIES) {
+      attempts_++;
+      resentAt_ = millis();
+      for (uint8_t i = 0; i < count_; i++) {
+        if (acked_[i]) continue;
+        retries_++;
+        send(i);
+      }
+      return;
+    }
+
+    LOG_WARN("[WLED UDP] %u of %u controllers didn't ack", unacked(), count_);
+    for (uint8_t i = 0; i < count_; i++) {
+      if (acked_[i]) continue;
+      acks_[i].add(millis() - sentAt_, false);
+      known_[i] = 0;  // it may or may not have applied the command
+    }
+    finish();
+  }
+
+  bool idle() const override { return !awaiting_; }
+
+  void forget() override {
+    for (uint8_t i = 0; i < count_; i++) known_[i] = 0;
+  }
+
+  void printStats(Stream& out) const override {
+    out.print("[WLED UDP] controllers=");
+    out.print(count_);
+    out.print(" commands=");
+    out.print(commands_);
+    out.print(" dropped=");
+    out.print(dropped_);
+    out.print(" retries=");
+    out.print(retries_);
+    out.print(" unchanged=");
+    out.println(unchanged_);
+    spread_.print(out, "[WLED UDP] send_spread", "us");
+    skew_.print(out, "[WLED UDP] ack_skew", "ms");
+
+    char label[48];
+    for (uint8_t i = 0; i < count_; i++) {
+      const IPAddress& ip = targets_[i].ip;
+      snprintf(label, sizeof(label), "[WLED UDP] %u.%u.%u.%u:%u send", ip[0], ip[1], ip[2], ip[3], targets_[i].port);
+      sends_[i].print(out, label, "us");
+      if (expectSync_) {
+        snprintf(label, sizeof(label), "[WLED UDP] %u.%u.%u.%u:%u ack", ip[0], ip[1], ip[2], ip[3], targets_[i].port);
+        acks_[i].print(out, label, "ms");
+      }
+    }
+  }
+
+private:
+  WiFiUDP udp_;
+  const WledTarget* targets_;
+  uint8_t count_;
+  bool expectSync_;
+  bool begun_ = false;
+  unsigned long beginAt_ = 0;
+
+  char pending_[128];  // last command, kept for retries
+  size_t length_ = 0;
+  WledState pendingState_;
+  uint8_t pendingFields_ = 0;
+  WledState ackedState_[WLED_UDP_MAX];  // per controller, as of its last ack
+  uint8_t known_[WLED_UDP_MAX] = {};    // WledState fields of ackedState_ we can trust
+  bool awaiting_ = false;
+  bool acked_[WLED_UDP_MAX];
+  uint8_t attempts_ = 0;
+  unsigned long sentAt_ = 0;
+  unsigned long resentAt_ = 0;
+  unsigned long polledAt_ = 0;
+  unsigned long firstAckAt_ = 0;
+  unsigned long lastAckAt_ = 0;
+
+  uint32_t commands_ = 0;
+  uint32_t dropped_ = 0;  // sent before the socket could be opened
+  uint32_t retries_ = 0;
+  uint32_t unchanged_ = 0;  // controllers not waited for, the command didn't change them
+  LatencyStats sends_[WLED_UDP_MAX];  // failures = the module refused the datagram
+  LatencyStats acks_[WLED_UDP_MAX];   // failures = no ack after the retries
+  LatencyStats spread_;               // first to last datagram of a command
+  LatencyStats skew_;                 // first to last ack of a command
+
+  bool begin() {
+    if (begun_) return true;
+    if (beginAt_ != 0 && millis() - beginAt_ < WLED_UDP_BEGIN_RETRY_MS) return false;
+    beginAt_ = millis();
+    begun_ = udp_.begin(WLED_UDP_PORT) == 1;
+    if (!begun_) LOG_WARN("[WLED UDP] can't open port %u yet", WLED_UDP_PORT);
+    return begun_;
+  }
+
+  void drain() {
+    for (uint8_t n = 0; n < 2 * WLED_UDP_MAX && udp_.parsePacket() > 0; n++) {
+    }
+  }
+
+  static size_t command(const WledState& want, uint8_t fields, char* out, size_t size) {
+    JsonDocument j;
+    if (fields & WledState::ON) j["on"] = want.on;
+    if (fields & WledState::PS) j["ps"] = want.ps;
+    if (fields & WledState::SEG) {
+      JsonObject seg0 = j["seg"].to<JsonArray>().add<JsonObject>();
+      if (fields & WledState::FX) seg0["fx"] = want.fx;
+      if (fields & WledState::SX) seg0["sx"] = want.sx;
+      if (fields & WledState::PAL) seg0["pal"] = want.pal;
+      if (fields & WledState::COL) {
+        JsonArray col0 = seg0["col"].to<JsonArray>().add<JsonArray>();
+        col0.add(want.col[0]);
+        col0.add(want.col[1]);
+        col0.add(want.col[2]);
+      }
+    }
+    return serializeJson(j, out, size);
+  }
+
+  void send(uint8_t i) {
+    unsigned long start = micros();
+    bool ok = udp_.beginPacket(targets_[i].ip, targets_[i].port) == 1;
+    if (ok) {
+      udp_.write((const uint8_t*)pending_, length_);
+      ok = udp_.endPacket() == 1;
+    }
+    sends_[i].add(micros() - start, ok);
+  }
+
+  void handlePacket() {
+    uint8_t kind;
+    if (udp_.read(&kind, 1) != 1 || kind != 0) return;  // not a sync notification
+
+    IPAddress from = udp_.remoteIP();
+    uint16_t port = udp_.remotePort();
+    for (uint8_t i = 0; i < count_; i++) {
+      if (acked_[i] || targets_[i].ip != from || targets_[i].port != port) continue;
+      acked_[i] = true;
+      applied(i);
+      unsigned long now = millis();
+      acks_[i].add(now - sentAt_);
+      if (firstAckAt_ == 0) firstAckAt_ = now;
+      lastAckAt_ = now;
+      return;
+    }
+  }
+
+  // The pending command leaves controller i as it last acked
+  bool unchanged(uint8_t i) const {
+    uint8_t fields = pendingFields_;
+    if (fields & WledState::PS) return false;
+    if ((fields & known_[i]) != fields) return false;
+    const WledState& was = ackedState_[i];
+    const WledState& want = pendingState_;
+    if ((fields & WledState::ON) && was.on != want.on) return false;
+    if ((fields & WledState::FX) && was.fx != want.fx) return false;
+    if ((fields & WledState::SX) && was.sx != want.sx) return false;
+    if ((fields & WledState::PAL) && was.pal != want.pal) return false;
+    if ((fields & WledState::COL) && memcmp(was.col, want.col, 3) != 0) return false;
+    return true;
+  }
+
+  // Controller i acked the pending command
+  void applied(uint8_t i) {
+    uint8_t fields = pendingFields_;
+    WledState& now = ackedState_[i];
+    const WledState& want = pendingState_;
+    if (fields & WledState::ON) now.on = want.on;
+    if (fields & WledState::FX) now.fx = want.fx;
+    if (fields & WledState::SX) now.sx = want.sx;
+    if (fields & WledState::PAL) now.pal = want.pal;
+    if (fields & WledState::COL) memcpy(now.col, want.col, 3);
+    if (fields & WledState::PS) {
+      now.ps = want.ps;
+      known_[i] &= ~WledState::SEG;  // a preset changes the segment in ways we can't see
+    }
+    known_[i] |= fields & ~WledState::PS;
+  }
+
+  uint8_t unacked() const {
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < count_; i++) {
+      if (!acked_[i]) n++;
+    }
+    return n;
+  }
+
+  void finish() {
+    awaiting_ = false;
+    if (count_ > 1 && unacked() == 0) {
+      skew_.add(lastAckAt_ - firstAckAt_);
+    }
+  }
+};
+
+#endif
@@ -1,6 +1,23 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+// -------
+// Logging
+// -------
+// Log calls below this level are compiled out:
+// LOG_LEVEL_DEBUG, LOG_LEVEL_INFO, LOG_LEVEL_WARN, LOG_LEVEL_ERROR or LOG_LEVEL_NONE
+#define LOG_LEVEL LOG_LEVEL_INFO
+
+// Log records are queued and printed from loop() when the serial port has
+// room, so a slow or missing USB host never stalls a scan.
+// Set to 0 to print immediately (e.g. to compare loop times in the health check output).
+#define LOG_DEFERRED 1
+
+// Record a timeline of FSM events, card reads, automation and network calls
+// in RAM (about 3 KB).  Send 't' on the serial monitor to dump it.
+#define TRACE_ENABLED 1
+
+
 // ----------
 // Automation
 // ----------
@@ -23,20 +40,50 @@ NoAutomation automation;
 // #include "WledAutomation.h"
 // WledAutomation automation;
 
+// WledAutomation can drive several WLED controllers together over WiFi instead of serial.  See WledUdpLink.h.
+// #include "WledAutomation.h"
+// #include "WledUdpLink.h"
+// const WledTarget wledControllers[] = {
+//   { IPAddress(192, 168, 5, 50) },
+//   { IPAddress(192, 168, 5, 51) },
+// };
+// WledUdpLink wledUdp(wledControllers, 2);
+// WledAutomation automation(wledUdp);
+
 // #include "WledSoundAutomation.h"
 // WledSoundAutomation automation;
 
+// CueAutomation plays a timeline of WLED, sound and signal cues.  See CueAutomation.h for the cue list format.
+// #include "CueAutomation.h"
+// const Cue show[] = {
+//   CUE_PRESET(0, 3),
+//   CUE_TRACK(150, 2),
+//   CUE_COLOR(2400, 255, 0, 0),
+//   CUE_END(10000),
+// };
+// CueAutomation automation(show, CUE_COUNT(show));
+
 
 // --------
 // Scanning
 // --------
-// Max time allowed to process a scan, e.g. send it to the server.
+// Max time allowed to process a scan.
 // If timeout is hit, will move on to next state.
 #define SCAN_TIMEOUT_MS 5000
 
 // Max time allowed for automation to complete.  
 // If timeout is hit, will move back to ready state.
+// The actual timeout is learned from how long the automation usually takes
+// (about p99 + AUTOMATION_TIMEOUT_MARGIN_MS), and kept between
+// AUTOMATION_TIMEOUT_MIN_MS and AUTOMATION_TIMEOUT_MS.
 #define AUTOMATION_TIMEOUT_MS 15000
+#define AUTOMATION_TIMEOUT_MIN_MS 2000
+#define AUTOMATION_TIMEOUT_MARGIN_MS 1000
+
+// After a timeout the automation is cancelled, and the scanner waits for it
+// to confirm it has stopped (lights off, sound stopped) before reading the
+// next tag, so a new show can't start over the old one.  Waits at most this long.
+#define AUTOMATION_STOP_TIMEOUT_MS 1000
 
 // Time to wait before clearning scan history.
 // Set to 0 to not automatically clear.  
@@ -44,8 +91,53 @@ NoAutomation automation;
 #define CLEAR_HISTORY_AFTER_MS 30'000
 
 // Number of tags to keep in the history list. If a tag is in the list, it cannot be rescanned.
+// Set to at least INVENTORY_MAX_TAGS if groups tap several tags together.
 #define RECENT_SCAN_HISTORY_SIZE 1
 
+// Max tags read from one tap.  All tags held to the reader together are
+// read in one pass and handled as one scan: the automation runs once, and
+// each tag is uploaded.
+#define INVENTORY_MAX_TAGS 5
+
+// Read ticket data from each tag's user memory while it's selected, and
+// send it with the scan as "data" (hex in JSON, a byte string in CBOR).
+// NTAG21x tags are read with one FAST_READ; MIFARE Classic tags with
+// key A on sector 1.  The record format is in TagPayload.h.  Payloads
+// are skipped for the rest of a tap once it has taken TAG_PAYLOAD_BUDGET_US.
+#define TAG_PAYLOAD_ENABLED 0
+#define TAG_PAYLOAD_KEY { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF }  // factory default
+#define TAG_PAYLOAD_BUDGET_US 50000
+
+// Reject tags the server has marked invalid or already redeemed, without a
+// network round trip at scan time.  The scanner keeps a local copy of the
+// rejected set (up to TAG_FILTER_MAX tags, see TagFilter.h), synced from
+// GET /api/tag_filter while idle and read a few lines per loop.
+// Rejected tags show an X on the matrix and don't run the automation.
+// Uses about 4 KB of RAM (the set, and a copy for the sync to build).
+#define TAG_FILTER_ENABLED 0
+#define TAG_SYNC_INTERVAL_MS 1000L * 60 * 5
+#define TAG_SYNC_TIMEOUT_MS 3000      // give up on a sync after this long without a line
+#define TAG_SYNC_LINES_PER_LOOP 8
+#define TAG_SYNC_LINE_MS 200          // max wait for the rest of a line that has started arriving
+#define TAG_REJECT_DISPLAY_MS 2000
+
+// Scans are stamped with UTC time ("at") and queued, then uploaded from the
+// ready state so a slow or unreachable server never delays a scan.  Uploads
+// that fail (no response, 5xx, 408 or 429) stay queued and are retried with
+// exponential backoff, up to SCAN_RETRY_MAX_MS apart.  Scans the server
+// refuses with any other 4xx are logged, dropped and counted as "refused".
+// If the queue fills, the oldest scan is dropped.
+#define SCAN_QUEUE_SIZE 16
+#define SCAN_UPLOAD_TIMEOUT_MS 3000
+#define SCAN_RETRY_MAX_MS 60000
+// Max scans per upload.  Above 1, queued scans are sent together as
+// {"events":[...]} to POST /api/tracking_events/batch.
+#define SCAN_UPLOAD_BATCH 1
+
+// The RTC keeps UTC time for the "at" stamp.  It's set from SNTP (via the
+// WiFi module) once connected, and resynced at this interval.
+#define CLOCK_SYNC_INTERVAL_MS 1000L * 60 * 60
+
 // ---------------
 // General Config
 // ---------------
@@ -53,14 +145,92 @@ NoAutomation automation;
 // Location number to send after successful scan
 #define LOCATION 0
 
-// Delay between health check calls
-#define HEALTH_CHECK_INTERVAL_MS 1000 * 60
+// Max time to wait at boot for the USB serial monitor to attach.
+// Scanning starts right after, whether or not one is attached.
+#define SERIAL_WAIT_MS 1500
+
+// How scans and health checks reach the server:
+//   TRANSPORT_HTTP - one POST per scan and a GET /api/health_checks per interval
+//   TRANSPORT_MQTT - one persistent MQTT session; scans are QoS 1 messages on
+//                    atm/<LOCATION>/scans, health is the keepalive plus a retained
+//                    atm/<LOCATION>/status message.  Needs the ArduinoMqttClient library.
+#define TRANSPORT_HTTP 0
+#define TRANSPORT_MQTT 1
+#define TRANSPORT TRANSPORT_HTTP
+
+// MQTT broker, used when TRANSPORT is TRANSPORT_MQTT
+#define MQTT_BROKER "192.168.5.229"
+#define MQTT_PORT 1883
+#define MQTT_KEEPALIVE_MS 30000
+
+// Heap limits for long runs.  If free memory, or the largest free block,
+// ever drops below these the heap is reported as DEGRADED in the health check.
+#define HEAP_MIN_FREE_BYTES 4096
+#define HEAP_MIN_BLOCK_BYTES 2048
+
+// Reset the board if loop() stops for longer than STALL_REBOOT_MS, e.g. a
+// network call that never returns.  Backed by the hardware watchdog.  The
+// call site it was stuck in is reported with the next health check.
+#define STALL_WATCHDOG_ENABLED 1
+#define STALL_REBOOT_MS 30000
+
+// Delay between health check calls.  Each delay is moved by a random amount,
+// up to HEALTH_CHECK_JITTER_PCT percent either way, and the first check
+// comes at a random point in the first interval, so a room of stations
+// powered on together doesn't check in all at once.
+#define HEALTH_CHECK_INTERVAL_MS 1000L * 60
+#define HEALTH_CHECK_JITTER_PCT 20
+
+// Send the health check fields along with each scan upload (as "health"),
+// and count a successful upload as the health check.  Standalone health
+// checks then only go out from stations that haven't uploaded for a full
+// interval.  Off by default: only turn it on once the server accepts the
+// extra field, since a server that doesn't may refuse the whole batch.
+#define HEALTH_PIGGYBACK 0
+
+// Talk to the server over HTTPS.  The WiFi module checks the server's
+// certificate against its built-in root CAs, or against TLS_CA_CERT if
+// defined (e.g. a self-signed CA for a local test server), as PEM:
+//   #define TLS_CA_CERT "-----BEGIN CERTIFICATE-----\n...\n-----END CERTIFICATE-----\n"
+#define USE_TLS 0
 
 // Configure the IP address and port for the server software.
 // const char *server = "192.168.5.229";
 // const int port = 3000;
 const char* server = "atm-clv-37eca624ed8b.herokuapp.com";
-const int port = 80;
+const int port = USE_TLS ? 443 : 80;
+
+// The connection to the server is kept open between requests, and closed
+// after this long without one (keep it under the server's idle timeout).
+// Saves a TCP connect, and with USE_TLS a TLS handshake, on most uploads.
+#define SERVER_KEEPALIVE_MS 45000
+
+// How scan uploads and health checks are encoded over HTTP:
+//   PAYLOAD_JSON - application/json
+//   PAYLOAD_CBOR - application/cbor, the same fields in binary (RFC 8949),
+//                  about a third smaller and built without a JSON document.
+//                  If the server answers 415 Unsupported Media Type the
+//                  scanner falls back to JSON until it restarts.
+// MQTT messages are always JSON.
+#define PAYLOAD_JSON 0
+#define PAYLOAD_CBOR 1
+#define PAYLOAD_ENCODING PAYLOAD_JSON
+
+// Max time to wait for the health check response
+#define HEALTH_CHECK_TIMEOUT_MS 3000
+
+// How long a resolved server address is reused before looking it up again.
+// The address is refreshed in the background DNS_REFRESH_AHEAD_MS before it
+// expires, and kept (served stale) if a lookup fails.
+#define DNS_CACHE_TTL_MS 1000L * 60 * 10
+#define DNS_REFRESH_AHEAD_MS 1000L * 30
+
+// Serve GET /metrics (Prometheus text) and GET /status (JSON) to the local
+// network, so stations can be checked on site without a serial monitor.
+// Served a step per loop, one client at a time.  Uses about 2.7 KB of RAM.
+// Off by default: anyone on the network can read the pages.
+#define STATUS_SERVER_ENABLED 0
+#define STATUS_SERVER_PORT 80
 
 // Add wifi credentials, to be tried in order until a successful connection.
 // For local development you can define credentials[] in a secrets.h file to add
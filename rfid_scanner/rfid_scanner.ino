@@ -1,15 +1,40 @@
 #include <SPI.h>
 #include <WiFiS3.h>
 
-#include <ArduinoHttpClient.h> // External: https://github.com/arduino-libraries/ArduinoHttpClient v0.6.1
 #include "Fsm.h"               // External: https://github.com/jonblack/arduino-fsm v2.2.0
 #include <MFRC522.h>           // External: https://github.com/miguelbalboa/rfid v1.4.12
 #include <ArduinoJson.h>       // External: https://github.com/bblanchon/ArduinoJson v7.3.0
 
+#include "WifiCredentials.h"
+#include "config.h"  // first, so LOG_LEVEL applies to every header
 #include "StringFifo.h"
+#include "Log.h"
+#include "LoopStats.h"
+#include "EventQueue.h"
+#include "TagFilter.h"
+#include "TagInventory.h"
+#include "ReaderTuner.h"
+#include "Trace.h"
+#include "StallWatch.h"
+#include "Bench.h"
+#include "HeapStats.h"
+#include "LatencyStats.h"
+#if TRANSPORT == TRANSPORT_MQTT
+#include "MqttTransport.h"
+#endif
+#if STATUS_SERVER_ENABLED
+#include "StatusServer.h"
+#endif
+#include "AdaptiveTimeout.h"
+#include "DnsCache.h"
+#include "HttpConnection.h"
+#include "CborWriter.h"
+#include "BootTimeline.h"
+#include "WifiConnector.h"
+#include "WallClock.h"
+#include "ScanQueue.h"
+#include "EepromLayout.h"
 #include "Matrix.h"
-#include "WifiCredentials.h"
-#include "config.h"
 
 
 // Configuration for LEDs that turn on after successful scan
@@ -26,13 +51,91 @@ const int credentialCount = sizeof(credentials) / sizeof(credentials[0]);
 
 // State
 unsigned long automationStartedAt = 0;
+bool automationDone = false;      // callback fired for the current run
+bool automationStopping = false;  // cancelled, waiting for automation.idle()
+unsigned long automationCancelledAt = 0;
+LatencyStats cancelStats;         // cancel() to idle(); failures = gave up waiting
 bool ledOn = false;
-String lastUid = "";
+// Tags read together in one tap; handled as one scan
+String scannedUids[INVENTORY_MAX_TAGS];
+uint8_t scannedTags[INVENTORY_MAX_TAGS];  // index in the inventory, for the payload
+uint8_t scannedCount = 0;
 unsigned long lastScanAt = 0;
+bool hasRecentScans = false;
 // Set the capacity to the number of recent scans to track.
 // If an RFID tag is scanned, and it's in this list, it will be ignored.
 // Prevents repeated scans.  MUST be at least 1.
 StringFifo<RECENT_SCAN_HISTORY_SIZE> recentlyScanned; 
+// Learns how long the automation usually takes, and times out at ~p99.
+AdaptiveTimeout automationTimeout(AUTOMATION_TIMEOUT_MIN_MS, AUTOMATION_TIMEOUT_MS, AUTOMATION_TIMEOUT_MARGIN_MS, EEPROM_ADDR_AUTOMATION_TIMEOUT);
+// Cached address of the tracking server, so uploads skip the DNS round trip.
+DnsCache serverDns(server, DNS_CACHE_TTL_MS, DNS_REFRESH_AHEAD_MS);
+#if USE_TLS
+WiFiSSLClient client;
+#else
+WiFiClient client;
+#endif
+// Kept open between uploads and health checks, see HttpConnection.h
+HttpConnection http(client, serverDns, server, port, USE_TLS, SERVER_KEEPALIVE_MS);
+// Cleared if the server turns CBOR away (415), see PAYLOAD_ENCODING
+bool cborAccepted = PAYLOAD_ENCODING == PAYLOAD_CBOR;
+WifiConnector wifiConnector(credentials, credentialCount);
+LoopStats loopStats;
+HeapStats heapStats(HEAP_MIN_FREE_BYTES, HEAP_MIN_BLOCK_BYTES);
+LatencyStats uploadStats;  // time to upload a batch of queued scans
+// Every JSON payload (scans, health, /status) is built here and serialized
+// before the next one starts.  ArduinoJson keeps its pool on the heap,
+// growing it as needed and releasing it when the document is cleared.
+JsonDocument jsonDoc;
+WallClock wallClock(CLOCK_SYNC_INTERVAL_MS);
+// Scans waiting for upload_scans()
+ScanQueue<SCAN_QUEUE_SIZE> pendingScans;
+unsigned long uploadRetryAt = 0;    // when the last upload failed
+unsigned long uploadBackoffMs = 0;  // 0 = no failed upload to back off from
+uint32_t scansRefused = 0;          // dropped because the server turned them away (4xx)
+int refusedStatus = 0;              // status of the last refused upload
+// How an upload went: taken, worth retrying, or refused for good
+enum UploadResult : uint8_t { UPLOAD_OK, UPLOAD_RETRY, UPLOAD_REFUSED };
+unsigned long healthCheckAt = 0;    // when the server last heard our health (or boot)
+unsigned long healthCheckDelayMs;   // jittered delay until the next standalone check
+bool healthCheckPending = false;    // standalone check sent, response not read yet
+unsigned long healthCheckSentAt = 0;
+bool healthCheckCbor = false;       // pending check was sent as CBOR
+uint32_t healthChecksSent = 0;      // standalone health check requests
+uint32_t healthPiggybacked = 0;     // uploads that carried health instead
+unsigned long statsPrintedAt = 0;
+#if TRANSPORT == TRANSPORT_MQTT
+MqttTransport mqttTransport(MQTT_BROKER, MQTT_PORT, LOCATION, MQTT_KEEPALIVE_MS);
+#endif
+#if STATUS_SERVER_ENABLED
+// GET /metrics and /status, see render_metrics() and render_status()
+StatusServer statusServer(STATUS_SERVER_PORT, render_metrics, render_status);
+#endif
+unsigned long heapSampledAt = 0;
+
+// Locally synced set of rejected tags, see sync_tag_filter()
+TagFilter tagFilter;
+uint32_t tagFilterVersion = 0;      // server version of the last completed sync
+unsigned long tagFilterSyncAt = 0;  // when the last sync was attempted
+bool tagFilterSyncTried = false;
+unsigned long tagFilterMaxUs = 0;   // slowest accept/reject decision
+// Sync in progress, see poll_tag_sync()
+bool tagSyncActive = false;         // request sent, response not fully read
+bool tagSyncHeadersRead = false;
+TagFilter tagFilterNext;            // built from the response, swapped in once complete
+uint32_t tagSyncVersion = 0;
+int tagSyncChanges = 0;
+unsigned long tagSyncProgressAt = 0;
+unsigned long rejectShownAt = 0;    // when the reject mark was put on the matrix
+bool rejectShown = false;
+
+// Boot: scanning starts right after RFID init; WiFi, automation self-test
+// and the status blinks finish from loop().
+BootTimeline<8> bootTimeline;
+bool booting = true;
+int pendingBlinks = 0;        // status blinks still to show
+unsigned long blinkAt = 0;    // when the LED last changed during a blink
+int blinkPhase = 0;           // 0 = off, 1 = on, 2 = pause after a group
                                 
 
 // Events
@@ -42,7 +145,11 @@ const uint8_t event_automation_started = 2;
 const uint8_t event_automation_ended = 3;
 const uint8_t event_automation_timed_out = 4;
 
-// States
+// States (ids are used in traces)
+const uint8_t state_id_ready = 0;
+const uint8_t state_id_scanned = 1;
+const uint8_t state_id_waiting = 2;
+uint8_t currentState = state_id_ready;
 State ready(&state_ready_on_enter, &state_ready_on, &state_ready_on_exit);
 State scanned(&state_scanned_on_enter, &state_scanned_on, &state_scanned_on_exit);
 State waiting(&state_waiting_on_enter, &state_waiting_on, &state_waiting_on_exit);
@@ -50,88 +157,204 @@ State waiting(&state_waiting_on_enter, &state_waiting_on, &state_waiting_on_exit
 // State machine
 Fsm scanner(&ready);
 
+// Events for the FSM, triggered from loop() rather than from inside handlers
+EventQueue<8> events;
+
 // Transitions
 void state_ready_on_enter() {
-  Serial.println("FSM ->ready");
+  LOG_DEBUG("FSM ->ready");
+  TRACE(TRACE_STATE, state_id_ready, 0, 0);
+  currentState = state_id_ready;
   disable_leds();
 
-  if (WiFi.status() != WL_CONNECTED) {
-    Serial.println("WiFI has disconnected.  Reconnecting...");
-    wifi_connect();
-  }
+  check_wifi();
 }
 
 void state_ready_on() {
-  String uid = read_next_rfid();
-  if (uid != "") {
-    lastUid = uid;
-    scanner.trigger(event_tag_scanned);
+  update_automation();  // advances self-tests while idle
+
+  // Don't start the next run over a cancelled one that is still stopping
+  if (automation_stopping()) return;
+
+  if (read_next_rfid() > 0) {
+    post_event(event_tag_scanned);
+    return;
   }
 
   clear_recent_scans();
+  clear_reject_display();
+  serverDns.poll();
+  wallClock.poll();
+  print_health_stats_when_due();
+
+  // The server connection is busy until the health check response is in
+  if (healthCheckPending) {
+    poll_health_check();
+    return;
+  }
+  // Likewise while a tag filter sync is being read
+  if (tagSyncActive) {
+    poll_tag_sync();
+    return;
+  }
+
+#if TRANSPORT == TRANSPORT_MQTT
+  mqttTransport.reconnect();
+#endif
+  http.poll();
+  sync_tag_filter();
+  upload_scans();
+
+  if (millis() - healthCheckAt >= healthCheckDelayMs) {
+    on_ready_health_check();
+  }
 }
 
 void state_ready_on_exit() {
-  Serial.println("FSM ready->");
+  LOG_DEBUG("FSM ready->");
 }
 
 void state_scanned_on_enter() {
-  Serial.println("FSM ->scanned");
+  LOG_DEBUG("FSM ->scanned");
+  TRACE(TRACE_STATE, state_id_scanned, 0, 0);
+  currentState = state_id_scanned;
 
   enable_leds();
 
-  automation.run(&automation_callback);
+  automationStartedAt = millis();
+  automationDone = false;
+  TRACE(TRACE_RUN, 0, 0, 0);
+  {
+    STALL_REGION(STALL_SITE_AUTOMATION_RUN);
+    automation.run(&automation_callback);
+  }
 
-  track_scan(lastUid);
-  lastUid = "";
+  for (uint8_t i = 0; i < scannedCount; i++) {
+    queue_scan(i);
+  }
+  scannedCount = 0;
 }
 
 void state_scanned_on() {
-  automation.update();
+  update_automation();
 
-  scanner.trigger(event_automation_started);
+  post_event(event_automation_started);
 }
 
 void state_scanned_on_exit() { 
-  Serial.println("FSM scanned->");
+  LOG_DEBUG("FSM scanned->");
 
   // disable_leds();  wait for animation to finish
 }
 
 void state_waiting_on_enter() {
-  Serial.println("FSM ->waiting");
+  LOG_DEBUG("FSM ->waiting");
+  TRACE(TRACE_STATE, state_id_waiting, 0, 0);
+  currentState = state_id_waiting;
+
+  // Done before we got here (e.g. a run that finishes within run()); the
+  // callback held back the event, since scanned has no transition for it
+  if (automationDone) {
+    post_event(event_automation_ended);
+  }
 }
 
 void state_waiting_on() {
-  automation.update();
+  if (millis() - automationStartedAt > automationTimeout.timeoutMs()) {
+    post_event(event_automation_timed_out);
+    return;
+  }
+
+  update_automation();
 }
 
 void state_waiting_on_exit() {
-  Serial.println("FSM waiting->");
+  LOG_DEBUG("FSM waiting->");
 
+  if (automationDone) return;
+
+  TRACE(TRACE_CANCEL, 0, 0, 0);
+  STALL_REGION(STALL_SITE_AUTOMATION_CANCEL);
   automation.cancel();
+  automationCancelledAt = millis();
+  automationStopping = true;
+}
+
+// True while a cancelled automation is still stopping, for at most
+// AUTOMATION_STOP_TIMEOUT_MS.  Records the cancel-to-idle time.
+bool automation_stopping() {
+  if (!automationStopping) return false;
+
+  unsigned long elapsed = millis() - automationCancelledAt;
+  bool idle = automation.idle();
+  if (!idle && elapsed < AUTOMATION_STOP_TIMEOUT_MS) return true;
+
+  if (!idle) {
+    LOG_WARN("[Cancel] automation still not idle after %lums, carrying on", elapsed);
+  }
+  automationStopping = false;
+  cancelStats.add(elapsed, idle);
+  TRACE(TRACE_CANCEL, 1, idle, elapsed);
+  return false;
 }
 
 void automation_callback() {
-  Serial.println("Automation is done. Triggering event event_automation_ended");
-  scanner.trigger(event_automation_ended);
+  LOG_INFO("Automation is done");
+  automationDone = true;
+  automationTimeout.addSample(millis() - automationStartedAt);
+  TRACE(TRACE_DONE, 0, 0, millis() - automationStartedAt);
+  // Still in scanned, the event would be dropped; state_waiting_on_enter() posts it
+  if (currentState == state_id_waiting) {
+    post_event(event_automation_ended);
+  }
 }
 
 // State transitions
 void on_event_tag_scanned() {
-  Serial.print("Scanned tag ");
-  Serial.println(lastUid);
+  for (uint8_t i = 0; i < scannedCount; i++) {
+    LOG_INFO("Scanned tag %s", scannedUids[i]);
+    remember_scan(scannedUids[i]);
+  }
+};
 
+void remember_scan(const String& uid) {
   lastScanAt = millis();
+  hasRecentScans = true;
 
   if (recentlyScanned.full()) {
     recentlyScanned.drop();
   }
-  recentlyScanned.push(lastUid);
-};
+  recentlyScanned.push(uid);
+}
 
 void on_ready_health_check() {
+  check_wifi();
   send_health_check();
+  schedule_health_check(HEALTH_CHECK_INTERVAL_MS);
+}
+
+// The server heard our health some other way (e.g. on a scan upload), so
+// push the standalone check back a full interval
+void health_check_delivered() {
+  schedule_health_check(HEALTH_CHECK_INTERVAL_MS);
+  stallWatch.clearRecord();  // reported once
+}
+
+// Next health check after about intervalMs, moved by up to
+// HEALTH_CHECK_JITTER_PCT either way.  Stations that boot together (e.g.
+// after a power cut) drift apart instead of hitting the server at once.
+void schedule_health_check(unsigned long intervalMs) {
+  long jitter = (long)(intervalMs / 100 * HEALTH_CHECK_JITTER_PCT);
+  healthCheckAt = millis();
+  healthCheckDelayMs = intervalMs + random(-jitter, jitter + 1);
+}
+
+void check_wifi() {
+  if (WiFi.status() != WL_CONNECTED && !wifiConnector.connecting()) {
+    LOG_WARN("WiFI has disconnected.  Reconnecting...");
+    TRACE(TRACE_WIFI, 0, 0, 0);
+    wifiConnector.start();
+  }
 }
 
 void on_event_acknowledged() {}
@@ -139,31 +362,52 @@ void on_event_automation_started(){}
 void on_event_automation_ended(){}
 
 void on_waiting_timed_out() {
-  Serial.println("[Timer] timed out while waiting for automation to end");
+  LOG_WARN("[Timer] timed out while waiting for automation to end after %lums", millis() - automationStartedAt);
+  automationTimeout.addTimeout();
 }
 
 void on_scanned_timed_out() { 
-  Serial.println("[Timer] timed out while processing scan");
+  LOG_WARN("[Timer] timed out while processing scan");
 }
 
-WiFiClient client;
-HttpClient httpClient = HttpClient(client, server, port);
 MFRC522 mfrc522(CS_PIN, RST_PIN);
+const byte tagPayloadKey[6] = TAG_PAYLOAD_KEY;
+TagPayloadReader tagPayloads(mfrc522, tagPayloadKey, TAG_PAYLOAD_BUDGET_US);
+TagInventory<INVENTORY_MAX_TAGS> inventory(mfrc522, TAG_PAYLOAD_ENABLED ? &tagPayloads : nullptr);
+ReaderTuner readerTuner(mfrc522, EEPROM_ADDR_READER_TUNING);
 Matrix matrix;
 
 void setup() {
   Serial.begin(115200);
-  delay(2000);
-  while (!Serial)
+  // Give a USB host a moment to attach, but never block a station without one
+  while (!Serial && millis() < SERIAL_WAIT_MS)
     ;
 
   Serial.println("\n\nSetup start");
+  bootTimeline.mark("serial");
+
+  // Watch for loop stalls from here on, and report the last one if it reset the board
+  stallWatch.begin(STALL_REBOOT_MS, STALL_WATCHDOG_ENABLED);
+  if (stallWatch.hasRecord()) {
+    const StallWatch::Record& r = stallWatch.record();
+    LOG_ERROR("Reset after a %lums stall in %s", r.stallMs, StallWatch::siteName(r.site));
+  }
 
   // Pins
   pinMode(LED_PIN, OUTPUT);
 
+  // Scanner setup
+  SPI.begin();
+  mfrc522.PCD_Init();
+  readerTuner.begin();
+  bootTimeline.mark("rfid");
+
+  wallClock.begin();
+#if USE_TLS && defined(TLS_CA_CERT)
+  client.setCACert(TLS_CA_CERT);
+#endif
+
   // FSM
-  scanner.add_timed_transition(&ready, &ready, HEALTH_CHECK_INTERVAL_MS, &on_ready_health_check);
   // ready -> scanned
   scanner.add_transition(&ready, &scanned, event_tag_scanned, &on_event_tag_scanned);
   // scanned -> waiting
@@ -171,204 +415,996 @@ void setup() {
   scanner.add_timed_transition(&scanned, &waiting, SCAN_TIMEOUT_MS, &on_scanned_timed_out);
   // waiting -> ready
   scanner.add_transition(&waiting, &ready, event_automation_ended, &on_event_automation_ended);
-  scanner.add_timed_transition(&waiting, &ready, AUTOMATION_TIMEOUT_MS, &on_waiting_timed_out);
+  scanner.add_transition(&waiting, &ready, event_automation_timed_out, &on_waiting_timed_out);
 
-  // Wifi setup
-  wifi_connect();
-  blink(1);
+  // Wifi setup, finished by boot_poll()
+  wifiConnector.start();
+
+  // Seed from the MAC so each station gets its own health check schedule;
+  // the first check lands anywhere in the first interval.
+  byte mac[6];
+  WiFi.macAddress(mac);
+  randomSeed(((uint32_t)mac[2] << 24 | (uint32_t)mac[3] << 16 | mac[4] << 8 | mac[5]) ^ micros());
+  healthCheckAt = millis();
+  healthCheckDelayMs = random(HEALTH_CHECK_INTERVAL_MS);
 
-  // Scanner setup
-  SPI.begin();
-  mfrc522.PCD_Init();
   matrix.number(LOCATION);
-  blink(2);
+  bootTimeline.mark("display");
 
   automation.setup();
-  blink(3);
+  automationTimeout.begin(automation.name());
+  bootTimeline.mark("scanning");
+  blink(2);
 }
 
 void loop() {
+  stallWatch.kick();
+  loopStats.begin();
   scanner.run_machine();
+  dispatch_events();
+  wifiConnector.poll();
+#if TRANSPORT == TRANSPORT_MQTT
+  mqttTransport.poll();
+#endif
+#if STATUS_SERVER_ENABLED
+  statusServer.poll();
+#endif
+  boot_poll();
+  loopStats.end();
+
+  logger.drain(Serial);
+  read_serial_commands();
+  sample_heap();
+}
+
+// Sample heap use once a second, and warn once it falls below the limits
+void sample_heap() {
+  if (millis() - heapSampledAt < 1000) return;
+  heapSampledAt = millis();
+
+  bool wasDegraded = heapStats.degraded();
+  heapStats.sample();
+  if (heapStats.degraded() && !wasDegraded) {
+    LOG_ERROR("Heap degraded: free_low=%u largest_block_low=%u", heapStats.freeLow(), heapStats.largestBlockLow());
+  }
+}
+
+// Advance the automation, tracing calls slow enough to delay a scan
+void update_automation() {
+  STALL_REGION(STALL_SITE_AUTOMATION_UPDATE);
+  unsigned long start = micros();
+  automation.update();
+  unsigned long us = micros() - start;
+  if (us >= TRACE_SLOW_UPDATE_US) {
+    TRACE(TRACE_UPDATE, 0, 0, us);
+  }
+}
+
+// Single-character commands from the serial monitor:
+//   t - dump the trace ring
+//   b - run the microbenchmarks (only while idle)
+void read_serial_commands() {
+  if (!Serial.available()) return;
+
+  char c = Serial.read();
+  if (c == 't') {
+    tracer.dump(Serial);
+  } else if (c == 'b') {
+    if (currentState == state_id_ready) {
+      run_benchmarks();
+    } else {
+      Serial.println("Benchmarks only run while the scanner is ready");
+    }
+  }
+}
+
+// Times the code that runs on every scan or loop iteration.  Uses scratch
+// copies where the real object holds scanner state.
+void run_benchmarks() {
+  STALL_REGION(STALL_SITE_BENCH);
+  benchBegin();
+
+  byte uid[7] = { 0x04, 0xA2, 0x3B, 0x0C, 0x5D, 0x80, 0x01 };
+  String uidStr = uid_string(uid, sizeof(uid));
+
+  bench(Serial, "uid_string", 1000, [&] {
+    String s = uid_string(uid, sizeof(uid));
+  });
+
+  StringFifo<RECENT_SCAN_HISTORY_SIZE> fifo;
+  while (!fifo.full()) fifo.push("00000000000000");
+  bench(Serial, "fifo_contains_miss", 1000, [&] {
+    fifo.contains(uidStr);
+  });
+  bench(Serial, "fifo_drop_push", 1000, [&] {
+    fifo.drop();
+    fifo.push(uidStr);
+  });
+
+  bench(Serial, "matrix_clear_frame", 1000, [] {
+    matrix.clearFrame();
+  });
+  bench(Serial, "matrix_add_to_frame", 1000, [] {
+    matrix.addToFrame('7', 4);
+  });
+  matrix.number(LOCATION);
+
+  ScanQueue<SCAN_QUEUE_SIZE> scans;
+  scans.push(uidStr.c_str(), 1751814000);
+  bench(Serial, "scan_json", 500, [&] {
+    char json[128];
+    build_scan_json(scans, 0, 1, false, json, sizeof(json));
+  });
+  bench(Serial, "scan_cbor", 500, [&] {
+    uint8_t cbor[128];
+    build_scan_cbor(scans, 0, 1, false, cbor, sizeof(cbor));
+  });
+
+  // A full batch upload, for comparing encodings at SCAN_UPLOAD_BATCH 8
+  while (scans.size() < 8 && !scans.full()) scans.push(uidStr.c_str(), 1751814000 + scans.size());
+  bench(Serial, "batch8_json", 100, [&] {
+    char json[640];
+    build_scan_json(scans, 0, 8, false, json, sizeof(json));
+  });
+  bench(Serial, "batch8_cbor", 100, [&] {
+    uint8_t cbor[640];
+    build_scan_cbor(scans, 0, 8, false, cbor, sizeof(cbor));
+  });
+  {
+    char buf[640];
+    print_payload_size("scan_json", build_scan_json(scans, 0, 1, false, buf, sizeof(buf)));
+    print_payload_size("scan_cbor", build_scan_cbor(scans, 0, 1, false, (uint8_t*)buf, sizeof(buf)));
+    print_payload_size("batch8_json", build_scan_json(scans, 0, 8, false, buf, sizeof(buf)));
+    print_payload_size("batch8_cbor", build_scan_cbor(scans, 0, 8, false, (uint8_t*)buf, sizeof(buf)));
+  }
+
+#if STATUS_SERVER_ENABLED
+  // What a scrape costs the loop, less the writes to the WiFi module
+  bench(Serial, "render_metrics", 100, [] {
+    statusServer.render(render_metrics);
+  });
+  bench(Serial, "render_status", 100, [] {
+    statusServer.render(render_status);
+  });
+  print_payload_size("metrics", statusServer.render(render_metrics));
+  print_payload_size("status", statusServer.render(render_status));
+#endif
+
+  // Same document WledLink sends for WledAutomation::turnOnPreset(),
+  // serialized to RAM rather than the UART so only the JSON work is timed
+  bench(Serial, "wled_preset_json", 500, [] {
+    char buf[32];
+    JsonDocument j;
+    j["on"] = true;
+    j["ps"] = 3;
+    j["v"] = true;
+    serializeJson(j, buf, sizeof(buf));
+  });
+
+  bench(Serial, "tag_filter_accept", 1000, [&] {
+    tagFilter.rejects(uid, sizeof(uid));
+  });
+
+  bench(Serial, "automation_update_idle", 1000, [] {
+    automation.update();
+  });
+
+  // Needs tags on the reader; named for how many were found, so run it
+  // once per group size (1..INVENTORY_MAX_TAGS) to compare.  Passes that
+  // found fewer tags than the first are counted as short.
+  uint8_t tags = inventory.scan(true);
+  if (tags > 0) {
+    char name[24];
+    snprintf(name, sizeof(name), "tag_inventory_%u", tags);
+    uint32_t passes = 0;
+    uint32_t shortPasses = 0;
+    uint32_t retries = inventory.retries();
+    uint32_t duplicates = inventory.duplicates();
+    bench(Serial, name, 50, [&] {
+      passes++;
+      if (inventory.scan(true) < tags) shortPasses++;
+    });
+    Serial.print("{\"inventory\":");
+    Serial.print(tags);
+    Serial.print(",\"passes\":");
+    Serial.print(passes);
+    Serial.print(",\"short_passes\":");
+    Serial.print(shortPasses);
+    Serial.print(",\"reqa_retries\":");
+    Serial.print(inventory.retries() - retries);
+    Serial.print(",\"duplicates\":");
+    Serial.print(inventory.duplicates() - duplicates);
+    Serial.println("}");
+
+    // Payload read of one tag (hold just one), named for its type.  Includes
+    // the wake and select; the read alone is in the [Payload] lines after.
+    MFRC522::Uid uid = inventory.tag(0);
+    TagPayload payload;
+    snprintf(name, sizeof(name), "tag_payload_%s", TagPayloadReader::typeName(uid.sak));
+    bench(Serial, name, 50, [&] {
+      tagPayloads.readAgain(uid, payload);
+    });
+    tagPayloads.printStats(Serial);
+  }
+}
+
+// Bytes on the wire for a benchmarked payload, in the same JSON-lines form
+void print_payload_size(const char* name, size_t bytes) {
+  Serial.print("{\"payload\":\"");
+  Serial.print(name);
+  Serial.print("\",\"bytes\":");
+  Serial.print(bytes);
+  Serial.println("}");
+}
+
+void post_event(uint8_t event) {
+  if (!events.post(event)) {
+    LOG_ERROR("Event queue full, dropped event %u", event);
+  }
+}
+
+// The one place FSM transitions happen
+void dispatch_events() {
+  EventQueue<8>::Event e;
+  while (events.pop(e)) {
+    TRACE(TRACE_EVENT, e.id, 0, micros() - e.postedAt);
+    scanner.trigger(e.id);
+  }
+}
+
+// Tracks the parts of boot that finish after scanning has started,
+// and prints the boot timeline once everything is up.
+void boot_poll() {
+  if (!booting) return;
+
+  if (WiFi.status() == WL_CONNECTED && !bootTimeline.has("wifi")) {
+    bootTimeline.mark("wifi");
+    blink(1);
+  }
+  if (automation.ready() && !bootTimeline.has("automation")) {
+    bootTimeline.mark("automation");
+    blink(3);
+  }
+  update_blink();
+
+  bool wifiSettled = WiFi.status() == WL_CONNECTED || !wifiConnector.connecting();
+  if (wifiSettled && automation.ready() && pendingBlinks == 0 && blinkPhase == 0) {
+    booting = false;
+    bootTimeline.mark("boot complete");
+    bootTimeline.print(Serial);
+  }
 }
 
 void enable_leds() {
-  Serial.println("[Action] enable LEDs");
+  LOG_DEBUG("[Action] enable LEDs");
   digitalWrite(LED_PIN, HIGH);
+  ledOn = true;
 }
 
 void disable_leds() {
-  Serial.println("[Action] disable LEDs");
+  LOG_DEBUG("[Action] disable LEDs");
   digitalWrite(LED_PIN, LOW);
+  ledOn = false;
 }
 
 void clear_recent_scans() {
-  if (CLEAR_HISTORY_AFTER_MS > 0 && lastScanAt > 0 && millis() - lastScanAt > CLEAR_HISTORY_AFTER_MS) {
-    Serial.println("[Action] clearning recent scans");
-    lastScanAt = 0;
+  if (CLEAR_HISTORY_AFTER_MS > 0 && hasRecentScans && millis() - lastScanAt > CLEAR_HISTORY_AFTER_MS) {
+    LOG_INFO("[Action] clearning recent scans");
+    hasRecentScans = false;
     while (!recentlyScanned.empty()) {
       recentlyScanned.drop();
     }
   }
 }
 
-bool connect_exp_backoff(WiFiClient& client, const char* server, uint16_t port, int maxRetries = 3, int initialDelayMs = 2) {
-  int delayMs = initialDelayMs;
+// Stamp scanned tag i and queue it, with its payload if it has one; upload_scans() sends it once the scanner is idle
+void queue_scan(uint8_t i) {
+  if (pendingScans.full()) {
+    LOG_WARN("[Action] scan queue full, dropping oldest scan");
+#if TRANSPORT == TRANSPORT_MQTT
+    mqttTransport.forgetOldest();
+#endif
+  }
+  const TagPayload& payload = inventory.payload(scannedTags[i]);
+  pendingScans.push(scannedUids[i].c_str(), wallClock.now(), payload.data, payload.length);
+}
 
-  for (int attempt = 1; attempt <= maxRetries; attempt++) {
-    if (client.connect(server, port)) {
-      return true;
+// Upload queued scans, oldest first, SCAN_UPLOAD_BATCH at a time.  If the
+// server can't be reached or is struggling, the scans stay queued and the
+// next try backs off exponentially.  A batch the server refuses outright
+// would be refused again, so it's dropped (and counted) instead of
+// blocking the queue behind it.
+void upload_scans() {
+#if TRANSPORT == TRANSPORT_MQTT
+  size_t acked = mqttTransport.takeAcked();
+  if (acked > 0) {
+    LOG_INFO("[Action] tracked %u scans via MQTT", acked);
+    pendingScans.drop(acked);
+  }
+#endif
+  if (pendingScans.empty() || WiFi.status() != WL_CONNECTED) return;
+  if (uploadBackoffMs > 0 && millis() - uploadRetryAt < uploadBackoffMs) return;
+
+  size_t count = min(pendingScans.size(), (size_t)SCAN_UPLOAD_BATCH);
+  unsigned long start = millis();
+  bool refused = false;
+#if TRANSPORT == TRANSPORT_MQTT
+  // The oldest scans may already be out, waiting on their PUBACK
+  size_t first = mqttTransport.scansInFlight();
+  if (first >= count) return;
+  count -= first;
+  size_t sent = track_scans_mqtt(first, count);
+#else
+  UploadResult result = track_scans_http(count);
+  size_t sent = result == UPLOAD_OK ? count : 0;
+  if (sent > 0 && HEALTH_PIGGYBACK) {
+    healthPiggybacked++;
+    health_check_delivered();
+  }
+  refused = result == UPLOAD_REFUSED;
+  if (refused) {
+    log_refused_scans(count);
+    scansRefused += count;
+    pendingScans.drop(count);
+  }
+#endif
+  uploadStats.add(millis() - start, sent == count);
+  TRACE(TRACE_NET, TRACE_NET_TRACK, sent, millis() - start);
+#if TRANSPORT != TRANSPORT_MQTT
+  pendingScans.drop(sent);  // over MQTT, only once acked
+#endif
+
+  if (sent == count || refused) {  // the server is answering; nothing to back off from
+    uploadBackoffMs = 0;
+  } else {
+    uploadRetryAt = millis();
+    uploadBackoffMs = uploadBackoffMs == 0 ? 1000 : min(uploadBackoffMs * 2, (unsigned long)SCAN_RETRY_MAX_MS);
+    uploadBackoffMs += random(uploadBackoffMs / 2);  // so stations don't all retry together after an outage
+    LOG_WARN("[Action] %u scans still queued, retrying in %lums", pendingScans.size(), uploadBackoffMs);
+  }
+}
+
+#if TRANSPORT == TRANSPORT_MQTT
+// One message per scan, for the count queued scans from first on.  They
+// stay queued until upload_scans() collects their PUBACKs.  Returns how
+// many were published.
+size_t track_scans_mqtt(size_t first, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    char jsonData[192];
+    size_t jsonLength = build_scan_json(pendingScans, first + i, 1, false, jsonData, sizeof(jsonData));
+
+    if (!mqttTransport.publishScan(jsonData, jsonLength)) {
+      LOG_ERROR("[Action] failed to track scan - MQTT not connected!");
+      return i;
     }
+  }
+  return count;
+}
+#endif
+
+// Every scan of a refused batch goes to the log before it's dropped, so
+// it can still be entered by hand.  A log record holds one string, so
+// the time is the raw epoch (0 if the clock wasn't set).
+void log_refused_scans(size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    const ScanEvent& scan = pendingScans.peek(i);
+    LOG_ERROR("[Action] dropping refused scan %s at %lu (status %d)", scan.uid, scan.at, refusedStatus);
+  }
+}
 
-    Serial.print("Connection failed. Backing off for ");
-    Serial.print(delayMs);
-    Serial.println("ms...");
-    delay(delayMs);
-    delayMs *= 2;  // Exponential backoff
+// Transport errors, 5xx, 408 and 429 are retried; any other 4xx is
+// refused for good.
+UploadResult track_scans_http(size_t count) {
+  STALL_REGION(STALL_SITE_UPLOAD);
+  char data[16 + 160 * SCAN_UPLOAD_BATCH + 160];
+  bool cbor = cborAccepted;
+  size_t length = cbor
+    ? build_scan_cbor(pendingScans, 0, count, HEALTH_PIGGYBACK, (uint8_t*)data, sizeof(data))
+    : build_scan_json(pendingScans, 0, count, HEALTH_PIGGYBACK, data, sizeof(data));
+
+  // Scans are only dropped from the queue once the server has taken them
+  const char* path = count > 1 ? "/api/tracking_events/batch" : "/api/tracking_events";
+  int status = http.request("POST", path, payload_type(cbor), data, length, nullptr, 0, SCAN_UPLOAD_TIMEOUT_MS);
+  if (cbor && status == 415) {
+    LOG_WARN("[Action] server doesn't accept CBOR, switching to JSON");
+    cborAccepted = false;
+    return UPLOAD_RETRY;  // retried as JSON after the usual backoff
+  }
+  if (status < 200 || status > 299) {
+    LOG_ERROR("[Action] failed to track scan - status %d", status);
+    bool refused = status >= 400 && status < 500 && status != 408 && status != 429;
+    if (!refused) return UPLOAD_RETRY;
+    refusedStatus = status;
+    return UPLOAD_REFUSED;
   }
 
-  Serial.println("All connection attempts failed!");
-  return false;
+  LOG_INFO("[Action] tracked %u scans via HTTP POST", count);
+  return UPLOAD_OK;
 }
 
-void track_scan(String uid) {
-  if (connect_exp_backoff(client, server, port)) {
-    // JSON payload
-    StaticJsonDocument<200> jsonDoc;
-    jsonDoc["id"] = uid;
-    jsonDoc["loc"] = LOCATION;
-    // hard coded for testing purposes
-    // jsonDoc["at"] = "2025-07-06T15:00:00Z";
-
-    String jsonData;
-    serializeJson(jsonDoc, jsonData);
-
-    // Build HTTP request
-    client.println("POST /api/tracking_events HTTP/1.1");  // Replace with your API endpoint
-    client.print("Host: ");
-    client.println(server);
-    client.println("Content-Type: application/json");
-    client.print("Content-Length: ");
-    client.println(jsonData.length());
-    client.println();          // Empty line before body
-    client.println(jsonData);  // JSON data
-
-    Serial.println("[Action] tracked scan via HTTP POST");
-  } else {
-    Serial.println("[Action] failed to track scan - connection failed!");
+// JSON for count queued scans starting at first: a single object, or
+// {"events":[...]} for a batch.  "at" is left out if the clock was never set,
+// so the server stamps the scan on arrival instead.  withHealth adds the
+// health check fields under "health", standing in for a separate check.
+size_t build_scan_json(const ScanQueue<SCAN_QUEUE_SIZE>& scans, size_t first, size_t count, bool withHealth, char* out, size_t size) {
+  jsonDoc.clear();
+  char at[21];
+  char data[2 * sizeof(ScanEvent::data) + 1];
+  JsonArray batch;
+  if (count > 1) {
+    batch = jsonDoc["events"].to<JsonArray>();
   }
 
-  // Read response
-  while (client.available()) {
-    String response = client.readString();
-    // Serial.println(response);
+  for (size_t i = 0; i < count; i++) {
+    const ScanEvent& scan = scans.peek(first + i);
+    JsonObject event = count > 1 ? batch.add<JsonObject>() : jsonDoc.to<JsonObject>();
+    event["id"] = (const char*)scan.uid;
+    event["loc"] = LOCATION;
+    if (scan.at != 0) {
+      WallClock::format(scan.at, at, sizeof(at));
+      event["at"] = at;  // non-const, so copied into the document
+    }
+    if (scan.dataLength > 0) {
+      format_hex(scan.data, scan.dataLength, data);
+      event["data"] = data;
+    }
+  }
+  if (withHealth) {
+    fill_health_json(jsonDoc["health"].to<JsonObject>());
   }
 
-  client.stop();  // Close connection
+  return serializeJson(jsonDoc, out, size);
+}
+
+// The same scans as build_scan_json(), encoded as CBOR straight into out.
+// Returns 0 if out is too small.
+size_t build_scan_cbor(const ScanQueue<SCAN_QUEUE_SIZE>& scans, size_t first, size_t count, bool withHealth, uint8_t* out, size_t size) {
+  CborWriter cbor(out, size);
+  if (count > 1) {
+    cbor.map(withHealth ? 2 : 1);
+    cbor.key("events");
+    cbor.array(count);
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    const ScanEvent& scan = scans.peek(first + i);
+    bool single = count == 1;
+    cbor.map(2 + (scan.at != 0) + (scan.dataLength > 0) + (single && withHealth));
+    cbor.key("id");
+    cbor.text(scan.uid);
+    cbor.key("loc");
+    cbor.integer(LOCATION);
+    if (scan.at != 0) {
+      char at[21];
+      WallClock::format(scan.at, at, sizeof(at));
+      cbor.key("at");
+      cbor.text(at);
+    }
+    if (scan.dataLength > 0) {
+      cbor.key("data");
+      cbor.bytes(scan.data, scan.dataLength);
+    }
+  }
+  if (withHealth) {
+    cbor.key("health");
+    write_health_cbor(cbor);
+  }
+
+  return cbor.ok() ? cbor.length() : 0;
+}
+
+const char* payload_type(bool cbor) {
+  return cbor ? "application/cbor" : "application/json";
+}
+
+// Fields every health report carries, standalone or piggybacked
+void fill_health_json(JsonObject health) {
+  health["l"] = LOCATION;
+  health["up"] = millis() / 1000;
+  health["rssi"] = WiFi.RSSI();
+  health["queued"] = pendingScans.size();
+  health["drift_s"] = wallClock.driftS();
+  health["sync_ms"] = wallClock.syncMs();
+  if (stallWatch.hasRecord()) {
+    const StallWatch::Record& r = stallWatch.record();
+    health["stall_site"] = StallWatch::siteName(r.site);
+    health["stall_ms"] = r.stallMs;
+  }
+}
+
+// fill_health_json() as a CBOR map
+void write_health_cbor(CborWriter& cbor) {
+  bool stall = stallWatch.hasRecord();
+  cbor.map(stall ? 8 : 6);
+  cbor.key("l");
+  cbor.integer(LOCATION);
+  cbor.key("up");
+  cbor.integer(millis() / 1000);
+  cbor.key("rssi");
+  cbor.integer(WiFi.RSSI());
+  cbor.key("queued");
+  cbor.integer(pendingScans.size());
+  cbor.key("drift_s");
+  cbor.integer(wallClock.driftS());
+  cbor.key("sync_ms");
+  cbor.integer(wallClock.syncMs());
+  if (stall) {
+    const StallWatch::Record& r = stallWatch.record();
+    cbor.key("stall_site");
+    cbor.text(StallWatch::siteName(r.site));
+    cbor.key("stall_ms");
+    cbor.integer(r.stallMs);
+  }
 }
 
 void send_health_check() {
-  StaticJsonDocument<200> jsonDoc;
-  jsonDoc["l"] = LOCATION;
-  String jsonData;
-  serializeJson(jsonDoc, jsonData);
-
-  Serial.println("[Action] sending health check");
-  httpClient.beginRequest();
-  httpClient.get("/api/health_checks");  // Path only
-  httpClient.sendHeader("Content-Type", "application/json");
-  httpClient.sendHeader("Content-Length", jsonData.length());
-  httpClient.beginBody();
-  httpClient.print(jsonData);
-  httpClient.endRequest();
-
-  // Print the HTTP response
-  int statusCode = httpClient.responseStatusCode();
-  String response = httpClient.responseBody();
-
-  Serial.print("[Action] health check result: status=");
-  Serial.print(statusCode);
-  Serial.print(", response=");
-  Serial.println(response);
-}
-
-void wifi_connect() {
-  for (int i = 0; i < credentialCount; i++) {
-    Serial.print("Attempting to connect to SSID=");
-    Serial.println(credentials[i].ssid);
-
-    int delayMS = 20;
-    for (int retries = 0; retries < 5; retries++) {
-      if (credentials[i].password == nullptr || credentials[i].password[0] == '\0') {
-        WiFi.begin(credentials[i].ssid);
-      } else {
-        WiFi.begin(credentials[i].ssid, credentials[i].password);
-      }
+#if TRANSPORT == TRANSPORT_MQTT
+  send_health_check_mqtt();
+#else
+  send_health_check_http();
+#endif
+}
 
-      int attempts = 0;
-      while (WiFi.status() != WL_CONNECTED && attempts < 10) {
-        delay(500);
-        attempts++;
-      }
+// Print the stats locally once per HEALTH_CHECK_INTERVAL_MS, however the
+// server is hearing about them
+void print_health_stats_when_due() {
+  if (millis() - statsPrintedAt < HEALTH_CHECK_INTERVAL_MS) return;
+  statsPrintedAt = millis();
+  print_health_stats();
+}
+
+#if TRANSPORT == TRANSPORT_MQTT
+// MQTT keepalive already tells the broker we're up; this refreshes the
+// retained status message with current numbers.
+void send_health_check_mqtt() {
+  fill_health_json(jsonDoc.to<JsonObject>());
+  jsonDoc["online"] = true;
+  char jsonData[192];
+  size_t jsonLength = serializeJson(jsonDoc, jsonData, sizeof(jsonData));
+
+  bool ok = mqttTransport.publishStatus(jsonData, jsonLength);
+  healthChecksSent++;
+  if (ok) stallWatch.clearRecord();  // reported once
+  if (ok) {
+    LOG_INFO("[Action] health status published via MQTT");
+  } else {
+    LOG_WARN("[Action] health status not published - MQTT not connected");
+  }
+}
+#endif
+
+// Sends the health check and returns; poll_health_check() reads the
+// response from later loops, so a scan is never kept waiting on it.
+void send_health_check_http() {
+  STALL_REGION(STALL_SITE_HEALTH);
+  char data[160];
+  size_t length;
+  bool cbor = cborAccepted;
+  if (cbor) {
+    CborWriter writer((uint8_t*)data, sizeof(data));
+    write_health_cbor(writer);
+    length = writer.ok() ? writer.length() : 0;
+  } else {
+    fill_health_json(jsonDoc.to<JsonObject>());
+    length = measureJson(jsonDoc) < sizeof(data) ? serializeJson(jsonDoc, data, sizeof(data)) : 0;
+  }
+  // Cut short it would be rejected, or misread; JSON is larger still, so
+  // there's nothing to fall back to.  The next check is still scheduled.
+  if (length == 0) {
+    LOG_ERROR("[Action] health check skipped - doesn't fit in %u bytes", sizeof(data));
+    return;
+  }
+
+  LOG_INFO("[Action] sending health check");
+  healthCheckSentAt = millis();
+  healthChecksSent++;
+  healthCheckCbor = cbor;
+  if (!http.send("GET", "/api/health_checks", payload_type(cbor), data, length)) {
+    LOG_ERROR("[Action] health check failed - connection failed");
+    TRACE(TRACE_NET, TRACE_NET_HEALTH, 0, millis() - healthCheckSentAt);
+    return;
+  }
+  healthCheckPending = true;
+}
+
+void poll_health_check() {
+  bool ready = http.responseReady();
+  if (!ready && millis() - healthCheckSentAt < HEALTH_CHECK_TIMEOUT_MS) return;
 
-      if (WiFi.status() == WL_CONNECTED) {
-        attempts = 0;
-        while (WiFi.localIP() == "0.0.0.0" && attempts < 10) {
-          delay(200);
-          attempts++;
-        }
-
-        Serial.print("Connected to SSID=");
-        Serial.print(WiFi.SSID());
-        Serial.print(", IP Address=");
-        Serial.print(WiFi.localIP());
-        Serial.print(", Gateway=");
-        Serial.print(WiFi.gatewayIP());
-        Serial.println("");
-        return;
+  STALL_REGION(STALL_SITE_HEALTH);
+  healthCheckPending = false;
+
+  // Once the response starts arriving the rest follows quickly
+  char response[64];
+  int statusCode = 0;
+  if (ready) {
+    statusCode = http.receive(response, sizeof(response), HEALTH_CHECK_TIMEOUT_MS);
+  } else {
+    http.close();  // the response may still turn up; don't let it be read as the next one
+    strcpy(response, "timed out");
+  }
+  TRACE(TRACE_NET, TRACE_NET_HEALTH, statusCode, millis() - healthCheckSentAt);
+  if (statusCode >= 200 && statusCode <= 299) {
+    stallWatch.clearRecord();  // reported once
+  }
+  if (healthCheckCbor && statusCode == 415) {
+    LOG_WARN("[Action] server doesn't accept CBOR, switching to JSON");
+    cborAccepted = false;
+  }
+
+  if (statusCode >= 200 && statusCode <= 299) {
+    LOG_INFO("[Action] health check result: status=%d, response=%s", statusCode, response);
+  } else {
+    LOG_WARN("[Action] health check result: status=%d, response=%s", statusCode, response);
+  }
+}
+
+void print_health_stats() {
+  uploadStats.print(Serial, "[Upload] scans", "ms");
+  Serial.print("[Health] standalone=");
+  Serial.print(healthChecksSent);
+  Serial.print(" piggybacked=");
+  Serial.println(healthPiggybacked);
+  print_clock_stats();
+#if TRANSPORT == TRANSPORT_MQTT
+  mqttTransport.printStats(Serial);
+#endif
+  serverDns.printStats(Serial);
+  http.printStats(Serial);
+#if STATUS_SERVER_ENABLED
+  statusServer.printStats(Serial);
+#endif
+  print_loop_stats();
+  heapStats.print(Serial);
+  cancelStats.print(Serial, "[Cancel] cancel_to_idle", "ms");
+  inventory.printStats(Serial);
+  if (TAG_PAYLOAD_ENABLED) {
+    tagPayloads.printStats(Serial);
+  }
+  readerTuner.printStats(Serial);
+  stallWatch.print(Serial);
+  automation.printStats(Serial);
+  if (TAG_FILTER_ENABLED) {
+    print_tag_filter_stats();
+  }
+}
+
+#if STATUS_SERVER_ENABLED
+// GET /metrics.  Loop times are since the last health stats print.
+void render_metrics(Print& out) {
+  print_metric(out, "atm_location", "gauge", LOCATION);
+  print_metric(out, "atm_uptime_seconds", "counter", millis() / 1000);
+  print_metric(out, "atm_state", "gauge", currentState);
+  print_metric(out, "atm_wifi_rssi_dbm", "gauge", WiFi.RSSI());
+  print_metric(out, "atm_heap_free_bytes", "gauge", heapStats.totalFree());
+  print_metric(out, "atm_heap_free_low_bytes", "gauge", heapStats.freeLow());
+  print_metric(out, "atm_heap_largest_block_bytes", "gauge", heapStats.largestBlock());
+  print_metric(out, "atm_loop_avg_us", "gauge", loopStats.avgUs());
+  print_metric(out, "atm_loop_max_us", "gauge", loopStats.maxUs());
+  print_metric(out, "atm_stall_worst_gap_ms", "gauge", stallWatch.worstGapMs());
+  print_metric(out, "atm_events_dropped_total", "counter", events.dropped());
+  print_metric(out, "atm_log_dropped_total", "counter", logger.dropped());
+  print_metric(out, "atm_scan_queue_depth", "gauge", pendingScans.size());
+  print_metric(out, "atm_scan_queue_dropped_total", "counter", pendingScans.dropped());
+  print_metric(out, "atm_scans_refused_total", "counter", scansRefused);
+  print_metric(out, "atm_uploads_total", "counter", uploadStats.count());
+  print_metric(out, "atm_upload_failures_total", "counter", uploadStats.failures());
+  print_metric(out, "atm_upload_last_ms", "gauge", uploadStats.last());
+  print_metric(out, "atm_upload_max_ms", "gauge", uploadStats.max());
+  print_metric(out, "atm_health_checks_total", "counter", healthChecksSent);
+  print_metric(out, "atm_health_piggybacked_total", "counter", healthPiggybacked);
+  print_metric(out, "atm_clock_drift_seconds", "gauge", wallClock.driftS());
+  print_metric(out, "atm_automation_timeout_ms", "gauge", automationTimeout.timeoutMs());
+  print_metric(out, "atm_automation_cancels_total", "counter", cancelStats.count());
+  print_metric(out, "atm_automation_cancel_max_ms", "gauge", cancelStats.max());
+  print_metric(out, "atm_status_scrapes_total", "counter", statusServer.scrapes());
+  print_metric(out, "atm_status_render_last_us", "gauge", statusServer.renderStats().last());
+  print_metric(out, "atm_status_poll_max_us", "gauge", statusServer.pollMaxUs());
+}
+
+// One sample with its TYPE line.  The format wants bare \n line endings.
+void print_metric(Print& out, const char* name, const char* type, long value) {
+  out.print("# TYPE ");
+  out.print(name);
+  out.print(' ');
+  out.print(type);
+  out.print('\n');
+  out.print(name);
+  out.print(' ');
+  out.print(value);
+  out.print('\n');
+}
+
+// GET /status: the health check fields plus what a tech on site asks first
+void render_status(Print& out) {
+  static const char* const stateNames[] = { "ready", "scanned", "waiting" };
+
+  fill_health_json(jsonDoc.to<JsonObject>());
+  jsonDoc["state"] = stateNames[currentState];
+  jsonDoc["automation"] = automation.name();
+  IPAddress ip = WiFi.localIP();
+  char ipStr[16];
+  snprintf(ipStr, sizeof(ipStr), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+  jsonDoc["ip"] = ipStr;  // non-const, so copied into the document
+  jsonDoc["heap_free"] = heapStats.totalFree();
+  jsonDoc["loop_avg_us"] = loopStats.avgUs();
+  jsonDoc["loop_max_us"] = loopStats.maxUs();
+  jsonDoc["dropped"] = pendingScans.dropped();
+  jsonDoc["refused"] = scansRefused;
+  if (refusedStatus) jsonDoc["refused_status"] = refusedStatus;
+  jsonDoc["uploads"] = uploadStats.count();
+  jsonDoc["upload_failures"] = uploadStats.failures();
+  jsonDoc["automation_timeout_ms"] = automationTimeout.timeoutMs();
+  char now[21];
+  if (wallClock.synced()) {
+    WallClock::format(wallClock.now(), now, sizeof(now));
+    jsonDoc["time"] = now;
+  }
+  serializeJson(jsonDoc, out);
+}
+#endif
+
+// Wall clock sync and the upload queue it lets scans wait in
+void print_clock_stats() {
+  Serial.print("[Clock] synced=");
+  Serial.print(wallClock.synced());
+  Serial.print(" syncs=");
+  Serial.print(wallClock.syncs());
+  Serial.print(" drift_s=");
+  Serial.print(wallClock.driftS());
+  Serial.print(" sync_ms=");
+  Serial.print(wallClock.syncMs());
+  Serial.print(" queued=");
+  Serial.print(pendingScans.size());
+  Serial.print(" dropped=");
+  Serial.print(pendingScans.dropped());
+  Serial.print(" refused=");
+  Serial.print(scansRefused);
+  Serial.print(" refused_status(last)=");
+  Serial.println(refusedStatus);
+}
+
+// Loop time (excluding log output) since the last report, and log ring health
+void print_loop_stats() {
+  Serial.print("[Loop] iterations=");
+  Serial.print(loopStats.count());
+  Serial.print(" us(avg/max)=");
+  Serial.print(loopStats.avgUs());
+  Serial.print("/");
+  Serial.print(loopStats.maxUs());
+  Serial.print(" events(high/dropped)=");
+  Serial.print(events.highWater());
+  Serial.print("/");
+  Serial.print(events.dropped());
+  Serial.print(" event_us(avg/max)=");
+  Serial.print(events.avgLatencyUs());
+  Serial.print("/");
+  Serial.print(events.maxLatencyUs());
+  Serial.print(" log(depth/high/dropped)=");
+  Serial.print(logger.depth());
+  Serial.print("/");
+  Serial.print(logger.highWater());
+  Serial.print("/");
+  Serial.println(logger.dropped());
+  loopStats.reset();
+}
+
+// Restore the location number once the reject mark has been shown long enough
+void clear_reject_display() {
+  if (rejectShown && millis() - rejectShownAt > TAG_REJECT_DISPLAY_MS) {
+    rejectShown = false;
+    matrix.number(LOCATION);
+  }
+}
+
+// Ask for changes to the rejected tag set since the last sync.  Runs from
+// the ready state; poll_tag_sync() reads the response a few lines per loop.
+//
+// Response body is plain text, one entry per line:
+//   v <version>   version to send as since= next time
+//   reset         full sync follows; drop everything held now
+//   +<uid hex>    tag is rejected
+//   -<uid hex>    tag is accepted again
+//   end <n>       last line; n is the number of +/- lines
+// Changes are applied to a copy of the filter, which replaces it (and the
+// version moves on) only once "end" arrives with the right count.  A cut
+// off response leaves the filter as it was, to be fetched again.
+void sync_tag_filter() {
+  if (!TAG_FILTER_ENABLED) return;
+  if (tagFilterSyncTried && millis() - tagFilterSyncAt < TAG_SYNC_INTERVAL_MS) return;
+  if (WiFi.status() != WL_CONNECTED) return;
+  STALL_REGION(STALL_SITE_TAG_SYNC);
+  tagFilterSyncAt = millis();
+  tagFilterSyncTried = true;
+
+  char path[48];
+  snprintf(path, sizeof(path), "/api/tag_filter?loc=%d&since=%lu", LOCATION, (unsigned long)tagFilterVersion);
+  if (!http.send("GET", path, nullptr, nullptr, 0)) {
+    LOG_WARN("[Action] tag filter sync failed - connection failed!");
+    return;
+  }
+
+  tagFilterNext = tagFilter;
+  tagSyncVersion = tagFilterVersion;
+  tagSyncChanges = 0;
+  tagSyncHeadersRead = false;
+  tagSyncProgressAt = millis();
+  tagSyncActive = true;
+}
+
+// Read what has arrived of the sync response, up to TAG_SYNC_LINES_PER_LOOP lines
+void poll_tag_sync() {
+  if (millis() - tagSyncProgressAt >= TAG_SYNC_TIMEOUT_MS) {
+    finish_tag_sync(false, "timed out");
+    return;
+  }
+
+  STALL_REGION(STALL_SITE_TAG_SYNC);
+  if (!tagSyncHeadersRead) {
+    if (!http.responseReady()) return;
+    int status = http.receiveHeaders(TAG_SYNC_LINE_MS);
+    if (status != 200) {
+      finish_tag_sync(false, "bad response");
+      return;
+    }
+    tagSyncHeadersRead = true;
+    tagSyncProgressAt = millis();
+    return;
+  }
+
+  char line[32];
+  for (int n = 0; n < TAG_SYNC_LINES_PER_LOOP && http.responseReady(); n++) {
+    if (!http.readBodyLine(line, sizeof(line), TAG_SYNC_LINE_MS)) {
+      finish_tag_sync(false, "response ended before \"end\"");
+      return;
+    }
+    tagSyncProgressAt = millis();
+
+    TagFilter::Uid uid;
+    if (strncmp(line, "end ", 4) == 0) {
+      bool complete = atoi(line + 4) == tagSyncChanges;
+      while (http.readBodyLine(line, sizeof(line), TAG_SYNC_LINE_MS))
+        ;  // the rest of the framing, so the connection can be reused
+      finish_tag_sync(complete, "entry count mismatch");
+      return;
+    } else if (line[0] == 'v' && line[1] == ' ') {
+      tagSyncVersion = strtoul(line + 2, nullptr, 10);
+    } else if (strcmp(line, "reset") == 0) {
+      tagFilterNext.reset();
+    } else if ((line[0] == '+' || line[0] == '-') && TagFilter::parseHex(line + 1, uid)) {
+      if (line[0] == '-') {
+        tagFilterNext.allow(uid.bytes, uid.size);
       } else {
-        Serial.println("Failed to connect");
+        tagFilterNext.deny(uid.bytes, uid.size);
       }
-
-      Serial.print("Waiting ");
-      Serial.print(delayMS);
-      Serial.println("ms before trying again");
-      delay(delayMS);
-      delayMS *= 2;
+      tagSyncChanges++;
     }
   }
-  Serial.println("Could not connect to any known networks.");
 }
 
-String read_next_rfid() {
-  if (mfrc522.PICC_IsNewCardPresent() && mfrc522.PICC_ReadCardSerial()) {
-    String uidStr = uid_string(mfrc522.uid.uidByte, mfrc522.uid.size);
+// Swap in the synced filter, or drop it and leave the current one
+void finish_tag_sync(bool ok, const char* why) {
+  tagSyncActive = false;
+  TRACE(TRACE_NET, TRACE_NET_TAG_SYNC, ok, millis() - tagFilterSyncAt);
+  if (!ok) {
+    http.close();  // the rest of the response may still arrive
+    LOG_WARN("[Action] tag filter sync failed - %s", why);
+    return;
+  }
+
+  tagFilter = tagFilterNext;
+  tagFilterVersion = tagSyncVersion;
+  LOG_INFO("[Action] tag filter synced to version %lu, %d changes", tagFilterVersion, tagSyncChanges);
+}
+
+void print_tag_filter_stats() {
+  Serial.print("[TagFilter] version=");
+  Serial.print(tagFilterVersion);
+  Serial.print(" rejected=");
+  Serial.print(tagFilter.count());
+  Serial.print("/");
+  Serial.print(TAG_FILTER_MAX);
+  Serial.print(" overflows=");
+  Serial.print(tagFilter.overflows());
+  Serial.print(" bytes=");
+  Serial.print(tagFilter.footprint());
+  Serial.print(" decision_us(max)=");
+  Serial.println(tagFilterMaxUs);
+}
+
+// Read every tag in the field, and keep the new, accepted ones in
+// scannedUids.  Returns how many were kept.
+uint8_t read_next_rfid() {
+  scannedCount = 0;
+  if (!readerTuner.pollDue()) return 0;
+
+  uint8_t found = inventory.scan();
+  readerTuner.addPoll(found, inventory.partials());
+  bool rejected = false;
+
+  for (uint8_t i = 0; i < found; i++) {
+    const MFRC522::Uid& tag = inventory.tag(i);
+    readerTuner.addLatency(inventory.uidUs(i));
+    String uidStr = uid_string(tag.uidByte, tag.size);
     if (recentlyScanned.contains(uidStr)) {
-      return "";
+      continue;
+    }
+
+    if (TAG_FILTER_ENABLED) {
+      unsigned long start = micros();
+      bool denied = tagFilter.rejects(tag.uidByte, tag.size);
+      unsigned long us = micros() - start;
+      if (us > tagFilterMaxUs) tagFilterMaxUs = us;
+
+      if (denied) {
+        LOG_INFO("Rejected tag %s", uidStr);
+        TRACE(TRACE_CARD_REJECT, tag.size, i, uid_prefix(tag.uidByte));
+        remember_scan(uidStr);  // don't flash again while it's held to the reader
+        rejected = true;
+        continue;
+      }
     }
 
-    mfrc522.PICC_HaltA();
+    TRACE(TRACE_CARD_READ, tag.size, i, uid_prefix(tag.uidByte));
+    scannedTags[scannedCount] = i;
+    scannedUids[scannedCount++] = uidStr;
+  }
 
-    return uidStr;
+  // Only show the reject mark if nothing in the group is going to run
+  if (rejected && scannedCount == 0) {
+    matrix.letter('X');
+    rejectShownAt = millis();
+    rejectShown = true;
   }
-  return "";
+  return scannedCount;
+}
+
+// First 4 UID bytes, enough to tell tags apart in a trace
+uint32_t uid_prefix(const byte* uid) {
+  return ((uint32_t)uid[0] << 24) | ((uint32_t)uid[1] << 16) | ((uint32_t)uid[2] << 8) | uid[3];
 }
 
-String uid_string(byte* uid, byte length) {
-  String uidStr = "";
-  for (byte i = 0; i < length; i++) {
-    if (uid[i] < 0x10) uidStr += "0";  // Ensure two-digit formatting
-    uidStr += String(uid[i], HEX);
+String uid_string(const byte* uid, byte length) {
+  // Format into a buffer first so the String is allocated once
+  char buf[2 * 10 + 1];  // UIDs are at most 10 bytes
+  format_hex(uid, min(length, (byte)10), buf);
+  return String(buf);
+}
+
+// Lowercase hex of length bytes into out, which needs 2 * length + 1
+void format_hex(const byte* bytes, size_t length, char* out) {
+  static const char hex[] = "0123456789abcdef";
+  for (size_t i = 0; i < length; i++) {
+    out[2 * i] = hex[bytes[i] >> 4];
+    out[2 * i + 1] = hex[bytes[i] & 0x0F];
   }
-  return uidStr;
+  out[2 * length] = '\0';
 }
 
+// Queue a group of status blinks; update_blink() plays them without blocking.
 void blink(int times) {
-  digitalWrite(LED_PIN, LOW);
-  for (int i = 0; i < times; i++) {
-    digitalWrite(LED_PIN, HIGH);
-    delay(120);
+  pendingBlinks += times;
+}
+
+void update_blink() {
+  // A scan owns the LEDs; drop any status blinks still queued
+  if (ledOn) {
+    pendingBlinks = 0;
+    blinkPhase = 0;
+    return;
+  }
+
+  unsigned long elapsed = millis() - blinkAt;
+  if (blinkPhase == 1 && elapsed >= 120) {
     digitalWrite(LED_PIN, LOW);
-    delay(100);
+    blinkPhase = pendingBlinks > 0 ? 0 : 2;
+    blinkAt = millis();
+  } else if (blinkPhase == 0 && pendingBlinks > 0 && elapsed >= 100) {
+    digitalWrite(LED_PIN, HIGH);
+    pendingBlinks--;
+    blinkPhase = 1;
+    blinkAt = millis();
+  } else if (blinkPhase == 2 && elapsed >= 1000) {
+    blinkPhase = 0;
   }
-  delay(1000);
 }
\ No newline at end of file